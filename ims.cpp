@@ -6,702 +6,5261 @@
 #include <iomanip>
 #include <algorithm>
 #include <memory>
+#include <string_view>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <unordered_set>
+#include <unordered_map>
+#include <climits>
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <memory_resource>
+#include <bitset>
+#include <cstdio>
+#include <filesystem>
+#include <cmath>
+#include <chrono>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IMS_HAVE_MMAP 1
+#define IMS_HAVE_POSIX_IO 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define IMS_HAVE_MMAP 0
+#define IMS_HAVE_POSIX_IO 0
+#endif
+
+#if defined(__linux__)
+#define IMS_HAVE_EPOLL 1
+#include <csignal>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#else
+#define IMS_HAVE_EPOLL 0
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define IMS_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define IMS_HAVE_AVX2 0
+#endif
 
 using namespace std;
 
+// Expiry dates are kept as days since 1970-01-01 for comparisons and scans
+const int32_t NO_EXPIRY = INT32_MAX;
+
+// Days since the epoch for a proleptic Gregorian date
+static int32_t daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+// Parse a DD/MM/YYYY expiry date; anything else yields NO_EXPIRY
+static int32_t parseExpiryDays(string_view text) {
+    int day = 0, month = 0, year = 0;
+    size_t first = text.find('/');
+    size_t second = (first == string_view::npos) ? first : text.find('/', first + 1);
+    if (second == string_view::npos) return NO_EXPIRY;
+    auto number = [](string_view digits, int& out) {
+        auto result = from_chars(digits.data(), digits.data() + digits.size(), out);
+        return !digits.empty() && result.ec == errc() && result.ptr == digits.data() + digits.size();
+    };
+    if (!number(text.substr(0, first), day) || !number(text.substr(first + 1, second - first - 1), month) ||
+        !number(text.substr(second + 1), year)) {
+        return NO_EXPIRY;
+    }
+    static const int monthDays[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month < 1 || month > 12 || day < 1 || day > monthDays[month - 1] || year < 1 || year > 9999) {
+        return NO_EXPIRY;
+    }
+    return daysFromCivil(year, month, day);
+}
+
+// Today as days since 1970-01-01 (UTC), to compare with parsed expiries
+static int32_t currentDay() {
+    auto seconds = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+    return static_cast<int32_t>(seconds / 86400);
+}
+
+// Category names are interned once and products carry a one-byte id instead
+// of their own string. Ids 0-2 are the built-in categories, each with its own
+// CSV file; other names (set through "update category") are registered on
+// first use. Registered names never move, so references to them stay valid.
+using CategoryId = uint8_t;
+
+class CategoryRegistry {
+public:
+    static constexpr CategoryId ELECTRONICS = 0;
+    static constexpr CategoryId FOOD = 1;
+    static constexpr CategoryId MEDICINE = 2;
+    static constexpr size_t BUILT_IN = 3;
+    static constexpr size_t MAX_CATEGORIES = 256;
+
+    // Id for a category name, registering it if needed. Once the table is
+    // full, further new names share the last id.
+    static CategoryId intern(string_view category) {
+        CategoryId id;
+        if (find(category, id)) return id;
+        Table& t = table();
+        lock_guard<mutex> guard(t.lock);
+        size_t count = t.count.load(memory_order_relaxed);
+        for (size_t i = 0; i < count; i++) {
+            if (t.names[i] == category) return static_cast<CategoryId>(i);
+        }
+        if (count == MAX_CATEGORIES) return static_cast<CategoryId>(MAX_CATEGORIES - 1);
+        t.names[count] = string(category);
+        t.count.store(count + 1, memory_order_release);
+        return static_cast<CategoryId>(count);
+    }
+
+    static bool find(string_view category, CategoryId& id) {
+        const Table& t = table();
+        size_t count = t.count.load(memory_order_acquire);
+        for (size_t i = 0; i < count; i++) {
+            if (t.names[i] == category) {
+                id = static_cast<CategoryId>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static const string& name(CategoryId id) { return table().names[id]; }
+
+    static size_t count() { return table().count.load(memory_order_acquire); }
+
+private:
+    struct Table {
+        mutex lock;
+        array<string, MAX_CATEGORIES> names;
+        atomic<size_t> count{BUILT_IN};
+        Table() {
+            names[ELECTRONICS] = "Electronics";
+            names[FOOD] = "Food";
+            names[MEDICINE] = "Medicine";
+        }
+    };
+
+    static Table& table() {
+        static Table instance;
+        return instance;
+    }
+};
+
+// Console text is built in one string and written with a single call.
+// These append a value left-aligned and padded to width, never truncated,
+// as `left << setw(width)` did.
+static void appendPadded(string& out, string_view value, size_t width = 0) {
+    out += value;
+    if (value.size() < width) out.append(width - value.size(), ' ');
+}
+
+static void appendPadded(string& out, long long value, size_t width = 0) {
+    char buffer[24];
+    auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+    appendPadded(out, string_view(buffer, result.ptr - buffer), width);
+}
+
+// Fixed-point with two decimals, as `fixed << setprecision(2)` printed it
+static void appendFixed(string& out, double value, size_t width = 0) {
+    char buffer[64];
+    auto result = to_chars(buffer, buffer + sizeof(buffer), value, chars_format::fixed, 2);
+    appendPadded(out, string_view(buffer, result.ptr - buffer), width);
+}
+
+// Money is a whole number of cents. Prices stay within [0, MAX_PRICE_CENTS],
+// so a product's value (price times an int quantity) always fits in 64 bits.
+using Cents = int64_t;
+static constexpr Cents MAX_PRICE_CENTS = INT32_MAX; // $21,474,836.47
+
+static bool isValidPrice(Cents price) { return price >= 0 && price <= MAX_PRICE_CENTS; }
+
+// Exact sum of money amounts. The 64-bit sum wraps and its carries are
+// counted, so amounts added and later subtracted again cancel exactly even
+// if a partial sum left the 64-bit range; cents() is the total only while
+// fits().
+struct MoneyTotal {
+    Cents low = 0;
+    int64_t carries = 0;
+
+    void add(Cents amount) {
+        if (__builtin_add_overflow(low, amount, &low)) carries += amount < 0 ? -1 : 1;
+    }
+    void subtract(Cents amount) {
+        if (__builtin_sub_overflow(low, amount, &low)) carries += amount < 0 ? 1 : -1;
+    }
+    void add(const MoneyTotal& other) {
+        add(other.low);
+        carries += other.carries;
+    }
+
+    bool fits() const { return carries == 0; }
+    Cents cents() const { return low; }
+    bool operator==(const MoneyTotal& other) const { return low == other.low && carries == other.carries; }
+};
+
+// Cents as dollars with two decimals, e.g. "-12.05"; at most 21 characters
+static char* formatCents(char* out, Cents value) {
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    if (value < 0) *out++ = '-';
+    out = to_chars(out, out + 20, magnitude / 100).ptr;
+    unsigned fraction = unsigned(magnitude % 100);
+    *out++ = '.';
+    *out++ = char('0' + fraction / 10);
+    *out++ = char('0' + fraction % 10);
+    return out;
+}
+
+static void appendMoney(string& out, Cents value, size_t width = 0) {
+    char buffer[24];
+    appendPadded(out, string_view(buffer, formatCents(buffer, value) - buffer), width);
+}
+
+static void appendMoney(string& out, const MoneyTotal& total, size_t width = 0) {
+    if (total.fits()) appendMoney(out, total.cents(), width);
+    else appendPadded(out, "overflow", width);
+}
+
 // Base Product class
 class Product {
+public:
+    // Strings are allocated through this, so products built in a
+    // ProductArena keep their text in the arena too
+    using allocator_type = pmr::polymorphic_allocator<char>;
+
 protected:
-    string productId;
-    string name;
-    double price;
-    int quantity;
-    string category;
+    pmr::string productId;
+    pmr::string name;
+    Cents price;
+    // On-hand quantity in the high 32 bits and the part of it held by open
+    // reservations in the low 32, in one atomic word so concurrent sales of
+    // a product change both together without a lock
+    atomic<uint64_t> stock;
+    CategoryId category;
+
+    static uint64_t packStock(int onHand, uint32_t held) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(onHand)) << 32) | held;
+    }
+    static uint64_t onHandDelta(int change) {
+        return static_cast<uint64_t>(static_cast<uint32_t>(change)) << 32;
+    }
+    static int onHandOf(uint64_t packed) { return static_cast<int32_t>(packed >> 32); }
+    static uint32_t heldOf(uint64_t packed) { return static_cast<uint32_t>(packed); }
+
+    // ID, name, category, price and stock columns of a console table row
+    void appendCommonDetails(string& out) const {
+        appendPadded(out, productId, 12);
+        appendPadded(out, name, 20);
+        appendPadded(out, getCategory(), 12);
+        appendPadded(out, "$", 10);
+        appendMoney(out, price);
+        appendPadded(out, getQuantity(), 8);
+    }
+
+    // id,name,price,quantity - the columns every category file starts with
+    void appendCommonCsvFields(string& out) const {
+        out += productId;
+        out += ',';
+        appendCsvField(out, name);
+        out += ',';
+        appendMoney(out, price);
+        out += ',';
+        appendCsvNumber(out, getQuantity());
+    }
 
 public:
     // Constructor
-    Product(const string& id, const string& n, double p, int q, const string& cat)
-        : productId(id), name(n), price(p), quantity(q), category(cat) {}
+    Product(string_view id, string_view n, Cents p, int q, CategoryId cat, allocator_type alloc = {})
+        : productId(id, alloc), name(n, alloc), price(p), stock(packStock(q, 0)), category(cat) {}
 
     // Virtual destructor for proper cleanup
     virtual ~Product() = default;
 
     // Pure virtual functions for polymorphism
-    virtual void displayDetails() const = 0;
-    virtual string getProductType() const = 0;
-    virtual vector<string> toCsvRow() const = 0;
-    virtual string getCsvHeader() const = 0;
-    virtual string getCsvFilename() const = 0;
+    // Append this product's row of the console tables, with line break
+    virtual void appendDetails(string& out) const = 0;
+    virtual string_view getProductType() const = 0;
+    // Append this product's CSV row (without line break) to out
+    virtual void toCsvRow(string& out) const = 0;
+    virtual string_view getCsvHeader() const = 0;
+    virtual string_view getCsvFilename() const = 0;
+
+    // Expiry as days since the epoch, for products that expire
+    virtual int32_t getExpiryDays() const { return NO_EXPIRY; }
 
     // Getters
-    string getProductId() const { return productId; }
-    string getName() const { return name; }
-    double getPrice() const { return price; }
-    int getQuantity() const { return quantity; }
-    string getCategory() const { return category; }
+    string_view getProductId() const { return productId; }
+    string_view getName() const { return name; }
+    Cents getPrice() const { return price; }
+    int getQuantity() const { return onHandOf(stock.load(memory_order_relaxed)); }
+    // On-hand quantity not held by reservations
+    int getAvailableStock() const {
+        uint64_t packed = stock.load(memory_order_relaxed);
+        return onHandOf(packed) - static_cast<int>(heldOf(packed));
+    }
+    const string& getCategory() const { return CategoryRegistry::name(category); }
+    CategoryId getCategoryId() const { return category; }
 
     // Setters
-    void setName(const string& n) { name = n; }
-    void setPrice(double p) { price = p; }
-    void setQuantity(int q) { quantity = q; }
-    void setCategory(const string& cat) { category = cat; }
+    void setName(string_view n) { name = n; }
+    void setPrice(Cents p) { price = p; }
+    void setQuantity(int q) {
+        uint64_t current = stock.load(memory_order_relaxed);
+        while (!stock.compare_exchange_weak(current, packStock(q, heldOf(current)), memory_order_relaxed)) {}
+    }
+    void setCategory(string_view cat) { category = CategoryRegistry::intern(cat); }
+    void setCategoryId(CategoryId cat) { category = cat; }
 
     // Utility methods
-    void updateStock(int change) { quantity += change; }
-    double getTotalValue() const { return price * quantity; }
+    Cents getTotalValue() const { return price * getQuantity(); }
 
-    // Helper function to escape CSV values
-    static string escapeCsv(const string& value) {
-        if (value.find(',') != string::npos || value.find('"') != string::npos || value.find('\n') != string::npos) {
-            string escaped = "\"";
-            for (char c : value) {
-                if (c == '"') escaped += "\"\"";
-                else escaped += c;
-            }
-            escaped += "\"";
-            return escaped;
+    // Add change to the on-hand quantity; false, leaving it unchanged, if the
+    // result would overflow. The add is a single fetch_add; an overflowing one
+    // is undone straight away.
+    bool updateStock(int change) {
+        uint64_t before = stock.fetch_add(onHandDelta(change), memory_order_relaxed);
+        int onHand = onHandOf(before);
+        if (change > 0 ? onHand > INT_MAX - change : onHand < INT_MIN - change) {
+            stock.fetch_sub(onHandDelta(change), memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Checkout in two steps: reserveStock holds count units, failing rather
+    // than letting available stock go negative; commitReservation then sells
+    // them or releaseReservation hands them back. Holds are never saved.
+    bool reserveStock(int count) {
+        uint64_t current = stock.load(memory_order_relaxed);
+        do {
+            int64_t available = static_cast<int64_t>(onHandOf(current)) - heldOf(current);
+            if (count <= 0 || available < count) return false;
+        } while (!stock.compare_exchange_weak(current, current + static_cast<uint32_t>(count),
+                                              memory_order_relaxed));
+        return true;
+    }
+
+    // Both are false if fewer than count units are held, e.g. because the
+    // product was removed and added again since the reservation; a commit is
+    // also false if the on-hand stock has since dropped below count
+    bool commitReservation(int count) {
+        return dropHeld(count, true);
+    }
+
+    bool releaseReservation(int count) {
+        return dropHeld(count, false);
+    }
+
+    // Undo an updateStock that succeeded by taking the same packed delta
+    // back off, which works for any change, INT_MIN included
+    void undoStockUpdate(int change) {
+        stock.fetch_sub(onHandDelta(change), memory_order_relaxed);
+    }
+
+    // Undo a commitReservation: the units are on hand and held again
+    void undoCommit(int count) {
+        stock.fetch_add(onHandDelta(count) + static_cast<uint32_t>(count), memory_order_relaxed);
+    }
+
+private:
+    // Release count held units, also taking them off the quantity if sold
+    bool dropHeld(int count, bool sold) {
+        uint64_t onHandChange = sold ? onHandDelta(count) : 0;
+        uint64_t current = stock.load(memory_order_relaxed);
+        do {
+            if (count <= 0 || heldOf(current) < static_cast<uint32_t>(count)) return false;
+            if (sold && onHandOf(current) < count) return false;
+        } while (!stock.compare_exchange_weak(current, current - onHandChange - static_cast<uint32_t>(count),
+                                              memory_order_relaxed));
+        return true;
+    }
+
+public:
+
+    // Append a value to a CSV row, quoting it if it contains separators
+    static void appendCsvField(string& out, string_view value) {
+        if (value.find_first_of(",\"\n") == string_view::npos) {
+            out += value;
+            return;
+        }
+        out += '"';
+        for (char c : value) {
+            if (c == '"') out += "\"\"";
+            else out += c;
         }
-        return value;
+        out += '"';
+    }
+
+    // Numbers are formatted without locale or temporary strings
+    static void appendCsvNumber(string& out, int value) {
+        char buffer[16];
+        auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+        out.append(buffer, result.ptr);
+    }
+
+    // Helper function to escape CSV values
+    static string escapeCsv(string_view value) {
+        string escaped;
+        appendCsvField(escaped, value);
+        return escaped;
     }
 };
 
 // Electronic Product class
 class Electronic : public Product {
 private:
-    string brand;
+    pmr::string brand;
     int warrantyMonths;
 
 public:
-    Electronic(const string& id, const string& n, double p, int q, 
-               const string& b, int warranty)
-        : Product(id, n, p, q, "Electronics"), brand(b), warrantyMonths(warranty) {}
-
-    void displayDetails() const override {
-        cout << left << setw(12) << productId 
-             << setw(20) << name 
-             << setw(12) << category
-             << setw(10) << "$" << fixed << setprecision(2) << price
-             << setw(8) << quantity
-             << setw(15) << brand
-             << setw(8) << warrantyMonths << " months" << endl;
-    }
-
-    string getProductType() const override { return "Electronic"; }
-    string getCsvFilename() const override { return "electronics_inventory.csv"; }
-
-    vector<string> toCsvRow() const override {
-        return {
-            productId,
-            escapeCsv(name),
-            to_string(price),
-            to_string(quantity),
-            escapeCsv(brand),
-            to_string(warrantyMonths)
-        };
+    Electronic(string_view id, string_view n, Cents p, int q, 
+               string_view b, int warranty, allocator_type alloc = {})
+        : Product(id, n, p, q, CategoryRegistry::ELECTRONICS, alloc), brand(b, alloc),
+          warrantyMonths(warranty) {}
+
+    void appendDetails(string& out) const override {
+        appendCommonDetails(out);
+        appendPadded(out, brand, 15);
+        appendPadded(out, warrantyMonths, 8);
+        out += " months\n";
+    }
+
+    string_view getProductType() const override { return "Electronic"; }
+    string_view getCsvFilename() const override { return "electronics_inventory.csv"; }
+
+    void toCsvRow(string& out) const override {
+        appendCommonCsvFields(out);
+        out += ',';
+        appendCsvField(out, brand);
+        out += ',';
+        appendCsvNumber(out, warrantyMonths);
     }
 
-    string getCsvHeader() const override {
+    string_view getCsvHeader() const override {
         return "product_id,name,price,quantity,brand,warranty_months";
     }
 
     // Getters for electronic-specific attributes
-    string getBrand() const { return brand; }
+    string_view getBrand() const { return brand; }
     int getWarrantyMonths() const { return warrantyMonths; }
 
     // Setters
-    void setBrand(const string& b) { brand = b; }
+    void setBrand(string_view b) { brand = b; }
     void setWarrantyMonths(int w) { warrantyMonths = w; }
 };
 
 // Food Product class
 class Food : public Product {
 private:
-    string expiryDate;
+    pmr::string expiryDate;
+    int32_t expiryDays;
     bool isOrganic;
 
 public:
-    Food(const string& id, const string& n, double p, int q, 
-         const string& expiry, bool organic)
-        : Product(id, n, p, q, "Food"), expiryDate(expiry), isOrganic(organic) {}
-
-    void displayDetails() const override {
-        cout << left << setw(12) << productId 
-             << setw(20) << name 
-             << setw(12) << category
-             << setw(10) << "$" << fixed << setprecision(2) << price
-             << setw(8) << quantity
-             << setw(15) << expiryDate
-             << setw(8) << (isOrganic ? "Yes" : "No") << endl;
-    }
-
-    string getProductType() const override { return "Food"; }
-    string getCsvFilename() const override { return "food_inventory.csv"; }
-
-    vector<string> toCsvRow() const override {
-        return {
-            productId,
-            escapeCsv(name),
-            to_string(price),
-            to_string(quantity),
-            escapeCsv(expiryDate),
-            (isOrganic ? "1" : "0")
-        };
+    Food(string_view id, string_view n, Cents p, int q, 
+         string_view expiry, bool organic, allocator_type alloc = {})
+        : Product(id, n, p, q, CategoryRegistry::FOOD, alloc), expiryDate(expiry, alloc),
+          expiryDays(parseExpiryDays(expiry)), isOrganic(organic) {}
+
+    void appendDetails(string& out) const override {
+        appendCommonDetails(out);
+        appendPadded(out, expiryDate, 15);
+        appendPadded(out, isOrganic ? "Yes" : "No", 8);
+        out += '\n';
     }
 
-    string getCsvHeader() const override {
+    string_view getProductType() const override { return "Food"; }
+    string_view getCsvFilename() const override { return "food_inventory.csv"; }
+
+    void toCsvRow(string& out) const override {
+        appendCommonCsvFields(out);
+        out += ',';
+        appendCsvField(out, expiryDate);
+        out += isOrganic ? ",1" : ",0";
+    }
+
+    string_view getCsvHeader() const override {
         return "product_id,name,price,quantity,expiry_date,is_organic";
     }
 
     // Getters for food-specific attributes
-    string getExpiryDate() const { return expiryDate; }
+    string_view getExpiryDate() const { return expiryDate; }
+    int32_t getExpiryDays() const override { return expiryDays; }
     bool getIsOrganic() const { return isOrganic; }
 
     // Setters
-    void setExpiryDate(const string& expiry) { expiryDate = expiry; }
+    void setExpiryDate(string_view expiry) {
+        expiryDate = expiry;
+        expiryDays = parseExpiryDays(expiry);
+    }
     void setIsOrganic(bool organic) { isOrganic = organic; }
 };
 
 // Medicine Product class (for pharmacy)
 class Medicine : public Product {
 private:
-    string manufacturer;
-    string expiryDate;
+    pmr::string manufacturer;
+    pmr::string expiryDate;
+    int32_t expiryDays;
     bool prescriptionRequired;
 
 public:
-    Medicine(const string& id, const string& n, double p, int q,
-             const string& mfg, const string& expiry, bool prescription)
-        : Product(id, n, p, q, "Medicine"), manufacturer(mfg), 
-          expiryDate(expiry), prescriptionRequired(prescription) {}
-
-    void displayDetails() const override {
-        cout << left << setw(12) << productId 
-             << setw(20) << name 
-             << setw(12) << category
-             << setw(10) << "$" << fixed << setprecision(2) << price
-             << setw(8) << quantity
-             << setw(15) << manufacturer
-             << setw(12) << expiryDate
-             << setw(8) << (prescriptionRequired ? "Yes" : "No") << endl;
-    }
-
-    string getProductType() const override { return "Medicine"; }
-    string getCsvFilename() const override { return "medicine_inventory.csv"; }
-
-    vector<string> toCsvRow() const override {
-        return {
-            productId,
-            escapeCsv(name),
-            to_string(price),
-            to_string(quantity),
-            escapeCsv(manufacturer),
-            escapeCsv(expiryDate),
-            (prescriptionRequired ? "1" : "0")
-        };
+    Medicine(string_view id, string_view n, Cents p, int q,
+             string_view mfg, string_view expiry, bool prescription, allocator_type alloc = {})
+        : Product(id, n, p, q, CategoryRegistry::MEDICINE, alloc), manufacturer(mfg, alloc), 
+          expiryDate(expiry, alloc), expiryDays(parseExpiryDays(expiry)), prescriptionRequired(prescription) {}
+
+    void appendDetails(string& out) const override {
+        appendCommonDetails(out);
+        appendPadded(out, manufacturer, 15);
+        appendPadded(out, expiryDate, 12);
+        appendPadded(out, prescriptionRequired ? "Yes" : "No", 8);
+        out += '\n';
+    }
+
+    string_view getProductType() const override { return "Medicine"; }
+    string_view getCsvFilename() const override { return "medicine_inventory.csv"; }
+
+    void toCsvRow(string& out) const override {
+        appendCommonCsvFields(out);
+        out += ',';
+        appendCsvField(out, manufacturer);
+        out += ',';
+        appendCsvField(out, expiryDate);
+        out += prescriptionRequired ? ",1" : ",0";
     }
 
-    string getCsvHeader() const override {
+    string_view getCsvHeader() const override {
         return "product_id,name,price,quantity,manufacturer,expiry_date,prescription_required";
     }
 
     // Getters for medicine-specific attributes
-    string getManufacturer() const { return manufacturer; }
-    string getExpiryDate() const { return expiryDate; }
+    string_view getManufacturer() const { return manufacturer; }
+    string_view getExpiryDate() const { return expiryDate; }
+    int32_t getExpiryDays() const override { return expiryDays; }
     bool getPrescriptionRequired() const { return prescriptionRequired; }
 
     // Setters
-    void setManufacturer(const string& mfg) { manufacturer = mfg; }
-    void setExpiryDate(const string& expiry) { expiryDate = expiry; }
+    void setManufacturer(string_view mfg) { manufacturer = mfg; }
+    void setExpiryDate(string_view expiry) {
+        expiryDate = expiry;
+        expiryDays = parseExpiryDays(expiry);
+    }
     void setPrescriptionRequired(bool prescription) { prescriptionRequired = prescription; }
 };
 
-// Inventory Manager class
-class InventoryManager {
+// Deletes heap-allocated products. Products living in a ProductArena are left
+// alone: the arena releases their memory, strings included, in one go.
+struct ProductDeleter {
+    bool inArena = false;
+
+    ProductDeleter() = default;
+    explicit ProductDeleter(bool arena) : inArena(arena) {}
+    // Lets unique_ptr<Electronic> etc. (from make_unique) convert to ProductPtr
+    template <typename T>
+    ProductDeleter(const default_delete<T>&) {}
+
+    void operator()(Product* product) const {
+        if (!inArena) delete product;
+    }
+};
+
+using ProductPtr = unique_ptr<Product, ProductDeleter>;
+
+// Monotonic arena owning the products created by one load. Product objects
+// and their strings are carved out of a few large blocks, so loading makes a
+// handful of allocations and teardown frees those blocks instead of every
+// product and string individually.
+class ProductArena {
 private:
-    vector<unique_ptr<Product>> inventory;
-    const vector<string> categoryFiles = {
-        "electronics_inventory.csv",
-        "food_inventory.csv", 
-        "medicine_inventory.csv"
+    pmr::monotonic_buffer_resource resource;
+    size_t products = 0;
+
+public:
+    explicit ProductArena(size_t initialBytes = 1 << 16) : resource(max<size_t>(initialBytes, 1024)) {}
+    ProductArena(const ProductArena&) = delete;
+    ProductArena& operator=(const ProductArena&) = delete;
+
+    template <typename T, typename... Args>
+    ProductPtr create(Args&&... args) {
+        void* memory = resource.allocate(sizeof(T), alignof(T));
+        T* product = new (memory) T(forward<Args>(args)..., Product::allocator_type(&resource));
+        products++;
+        return ProductPtr(product, ProductDeleter(true));
+    }
+
+    size_t productCount() const { return products; }
+};
+
+// Open-addressing hash index from product ID to its slot in the inventory vector.
+// Keys are string_views into each Product's own ID string, so lookups accept any
+// string_view without building a temporary std::string. Linear probing with
+// backward-shift deletion keeps the table free of tombstones.
+class ProductIdIndex {
+private:
+    struct Entry {
+        string_view key;
+        size_t hash;
+        size_t slot;
     };
 
-    // Helper function to split CSV line considering quoted fields
-    vector<string> parseCsvLine(const string& line) {
-        vector<string> tokens;
-        stringstream ss(line);
-        string token;
-        bool inQuotes = false;
-        string currentToken;
-
-        for (size_t i = 0; i < line.length(); i++) {
-            char c = line[i];
-            
-            if (c == '"') {
-                if (inQuotes && i + 1 < line.length() && line[i + 1] == '"') {
-                    // Handle escaped quotes
-                    currentToken += '"';
-                    i++; // Skip next quote
-                } else {
-                    inQuotes = !inQuotes;
-                }
-            } else if (c == ',' && !inQuotes) {
-                tokens.push_back(currentToken);
-                currentToken.clear();
-            } else {
-                currentToken += c;
-            }
+    static constexpr size_t EMPTY = ~size_t(0);
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    vector<Entry> table;
+    size_t count = 0;
+    unsigned bucketBits = 0;   // log2 of the table size
+
+    static size_t hashId(string_view id) { return hash<string_view>{}(id); }
+
+    size_t mask() const { return table.size() - 1; }
+
+    // Find the table position holding id, or EMPTY
+    size_t findPosition(string_view id, size_t h) const {
+        if (table.empty()) return EMPTY;
+        for (size_t pos = h & mask();; pos = (pos + 1) & mask()) {
+            const Entry& e = table[pos];
+            if (e.slot == EMPTY) return EMPTY;
+            if (e.hash == h && e.key == id) return pos;
         }
-        
-        tokens.push_back(currentToken); // Add the last token
-        return tokens;
     }
 
-    // Helper function to join CSV row
-    string joinCsvRow(const vector<string>& row) const {
-        string result;
-        for (size_t i = 0; i < row.size(); i++) {
-            if (i > 0) result += ",";
-            result += row[i];
+    void placeEntry(const Entry& entry) {
+        size_t pos = entry.hash & mask();
+        while (table[pos].slot != EMPTY) pos = (pos + 1) & mask();
+        table[pos] = entry;
+    }
+
+    void rehash(size_t newCapacity) {
+        vector<Entry> old;
+        old.swap(table);
+        table.assign(newCapacity, Entry{string_view(), 0, EMPTY});
+        for (bucketBits = 0; (size_t(1) << bucketBits) < newCapacity; bucketBits++) {}
+        for (const Entry& e : old) {
+            if (e.slot != EMPTY) placeEntry(e);
         }
-        return result;
     }
 
-    // Get products by category
-    vector<Product*> getProductsByCategory(const string& category) const {
-        vector<Product*> categoryProducts;
-        for (const auto& product : inventory) {
-            if (product->getCategory() == category) {
-                categoryProducts.push_back(product.get());
+public:
+    static constexpr size_t npos = EMPTY;
+
+    size_t size() const { return count; }
+
+    void clear() {
+        table.clear();
+        count = 0;
+        bucketBits = 0;
+    }
+
+    // Size the table so n keys fit without further rehashing (max load 3/4)
+    void reserve(size_t n) {
+        size_t needed = MIN_CAPACITY;
+        while (needed * 3 < n * 4) needed *= 2;
+        if (needed > table.size()) rehash(needed);
+    }
+
+    // Slot of the product with this ID, or npos
+    size_t find(string_view id) const {
+        size_t pos = findPosition(id, hashId(id));
+        return pos == EMPTY ? npos : table[pos].slot;
+    }
+
+    static size_t hashOf(string_view id) { return hashId(id); }
+
+    // Lookup with a hash already computed by hashOf()
+    size_t find(string_view id, size_t h) const {
+        size_t pos = findPosition(id, h);
+        return pos == EMPTY ? npos : table[pos].slot;
+    }
+
+    // Sort key for hashes that puts them in home bucket order, so a run of
+    // lookups sorted by it walks the table front to back. hashOfOrder undoes
+    // it while the table keeps its size.
+    size_t probeOrder(size_t h) const {
+        return bucketBits == 0 ? h : (h >> bucketBits) | (h << (sizeof(size_t) * CHAR_BIT - bucketBits));
+    }
+
+    size_t hashOfOrder(size_t order) const {
+        return bucketBits == 0 ? order : (order << bucketBits) | (order >> (sizeof(size_t) * CHAR_BIT - bucketBits));
+    }
+
+    // Start fetching the table entries a key with hash h will probe, so bulk
+    // inserts can overlap their cache misses. Only useful after reserve().
+    void prefetch(size_t h) const {
+#if defined(__GNUC__) || defined(__clang__)
+        if (!table.empty()) __builtin_prefetch(&table[h & mask()]);
+#endif
+    }
+
+    // Insert id -> slot; returns false if the ID is already indexed.
+    // id must stay valid for as long as it is in the index.
+    bool insert(string_view id, size_t slot) { return insert(id, slot, hashId(id)); }
+
+    // Insert with a hash already computed by hashOf()
+    bool insert(string_view id, size_t slot, size_t h) {
+        if (findPosition(id, h) != EMPTY) return false;
+        reserve(count + 1);
+        placeEntry(Entry{id, h, slot});
+        count++;
+        return true;
+    }
+
+    // Point an existing ID at a new slot (used when products move)
+    void updateSlot(string_view id, size_t slot) {
+        size_t pos = findPosition(id, hashId(id));
+        if (pos != EMPTY) table[pos].slot = slot;
+    }
+
+    bool erase(string_view id) {
+        size_t hole = findPosition(id, hashId(id));
+        if (hole == EMPTY) return false;
+
+        // Shift later entries of the probe run back so lookups never stop early
+        for (size_t next = (hole + 1) & mask(); table[next].slot != EMPTY; next = (next + 1) & mask()) {
+            size_t home = table[next].hash & mask();
+            if (((next - home) & mask()) >= ((next - hole) & mask())) {
+                table[hole] = table[next];
+                hole = next;
             }
         }
-        return categoryProducts;
+        table[hole].slot = EMPTY;
+        count--;
+        return true;
     }
+};
 
-    // Save products of a specific category to their respective CSV file
-    void saveCategoryToFile(const string& category, const string& filename) const {
-        vector<Product*> categoryProducts = getProductsByCategory(category);
-        
-        if (categoryProducts.empty()) {
-            return; // Don't create empty files
-        }
+// Stable reference to one product. Unlike a Product* or a slot number it
+// cannot be left pointing at another product: once its product is removed,
+// or the inventory is reloaded, it resolves to nothing.
+struct ProductHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
 
-        ofstream file(filename);
-        if (!file.is_open()) {
-            cout << "Error: Could not open " << filename << " for writing!\n";
-            return;
-        }
+    explicit operator bool() const { return index != UINT32_MAX; }
+    bool operator==(const ProductHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const ProductHandle& other) const { return !(*this == other); }
+};
+
+// Generational slot map over the inventory vector's slots. Each product
+// owns an entry that follows it as erasing a product moves the last one
+// into the gap; erasing bumps the entry's generation so older handles to it
+// go stale, and the entry goes on a free list for the next product.
+class ProductHandleTable {
+private:
+    struct Entry {
+        uint32_t slot;
+        uint32_t generation;
+    };
+
+    static constexpr uint32_t FREE = UINT32_MAX;
+
+    vector<Entry> entries;
+    vector<uint32_t> freeEntries;   // Reused last in, first out
+    vector<uint32_t> entryOfSlot;   // Parallel to the inventory vector
 
-        // Write CSV header
-        file << categoryProducts[0]->getCsvHeader() << endl;
+public:
+    static constexpr size_t npos = ~size_t(0);
+
+    void reserve(size_t n) {
+        entries.reserve(n);
+        entryOfSlot.reserve(n);
+    }
 
-        // Write data rows
-        for (const auto& product : categoryProducts) {
-            vector<string> row = product->toCsvRow();
-            file << joinCsvRow(row) << endl;
+    // Give the product just appended at the end of the inventory an entry
+    void append() {
+        uint32_t index;
+        if (freeEntries.empty()) {
+            index = uint32_t(entries.size());
+            entries.push_back(Entry{FREE, 0});
+        } else {
+            index = freeEntries.back();
+            freeEntries.pop_back();
         }
-        file.close();
+        entries[index].slot = uint32_t(entryOfSlot.size());
+        entryOfSlot.push_back(index);
     }
 
-    // Load products from a specific category CSV file
-    void loadCategoryFromFile(const string& filename, const string& category) {
-        ifstream file(filename);
-        if (!file.is_open()) {
-            return; // File doesn't exist, skip
+    // Free the entry of the product at slot as the last product moves into it
+    void erase(size_t slot) {
+        uint32_t index = entryOfSlot[slot];
+        entries[index].slot = FREE;
+        entries[index].generation++;
+        freeEntries.push_back(index);
+        if (slot + 1 != entryOfSlot.size()) {
+            entryOfSlot[slot] = entryOfSlot.back();
+            entries[entryOfSlot[slot]].slot = uint32_t(slot);
         }
+        entryOfSlot.pop_back();
+    }
 
-        string line;
-        bool isFirstLine = true;
-        
-        while (getline(file, line)) {
-            if (line.empty()) continue;
-            
-            // Skip header line
-            if (isFirstLine) {
-                isFirstLine = false;
-                continue;
-            }
+    // Free every entry, for a reload; no earlier handle resolves afterwards
+    void clear() {
+        for (uint32_t index : entryOfSlot) {
+            entries[index].slot = FREE;
+            entries[index].generation++;
+        }
+        freeEntries.insert(freeEntries.end(), entryOfSlot.rbegin(), entryOfSlot.rend());
+        entryOfSlot.clear();
+    }
 
-            vector<string> tokens = parseCsvLine(line);
-            if (tokens.size() < 4) continue; // Minimum required fields
+    ProductHandle handleOf(size_t slot) const {
+        uint32_t index = entryOfSlot[slot];
+        return ProductHandle{index, entries[index].generation};
+    }
 
-            try {
-                string id = tokens[0];
-                string name = tokens[1];
-                double price = stod(tokens[2]);
-                int quantity = stoi(tokens[3]);
+    // Slot of a handle's product, or npos if the handle is stale
+    size_t find(ProductHandle handle) const {
+        if (handle.index >= entries.size()) return npos;
+        const Entry& entry = entries[handle.index];
+        if (entry.generation != handle.generation || entry.slot == FREE) return npos;
+        return entry.slot;
+    }
+};
 
-                if (category == "Electronics" && tokens.size() >= 6) {
-                    string brand = tokens[4];
-                    int warranty = stoi(tokens[5]);
-                    inventory.push_back(make_unique<Electronic>(id, name, price, quantity, brand, warranty));
-                }
-                else if (category == "Food" && tokens.size() >= 6) {
-                    string expiry = tokens[4];
-                    bool organic = (tokens[5] == "1");
-                    inventory.push_back(make_unique<Food>(id, name, price, quantity, expiry, organic));
-                }
-                else if (category == "Medicine" && tokens.size() >= 7) {
-                    string manufacturer = tokens[4];
-                    string expiry = tokens[5];
-                    bool prescription = (tokens[6] == "1");
-                    inventory.push_back(make_unique<Medicine>(id, name, price, quantity, manufacturer, expiry, prescription));
-                }
-            } catch (const exception& e) {
-                cout << "Error parsing line in " << filename << ": " << line << endl;
-                cout << "Error: " << e.what() << endl;
+// Read-only view of a whole file. Uses mmap where available so large category
+// files are paged in on demand instead of copied through stream buffers.
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+#if IMS_HAVE_MMAP
+    bool mapped = false;
+#endif
+    vector<char> buffer; // Fallback storage when the file cannot be mapped
+
+    void close() {
+#if IMS_HAVE_MMAP
+        if (mapped) munmap(const_cast<char*>(data), length);
+        mapped = false;
+#endif
+        buffer.clear();
+        data = nullptr;
+        length = 0;
+    }
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const string& filename) {
+        close();
+#if IMS_HAVE_MMAP
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st{};
+        bool sized = fstat(fd, &st) == 0;
+        if (sized && S_ISDIR(st.st_mode)) {
+            ::close(fd);
+            return false;
+        }
+        if (sized && st.st_size > 0) {
+            void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+                data = static_cast<const char*>(p);
+                length = static_cast<size_t>(st.st_size);
+                mapped = true;
             }
         }
-        file.close();
+        ::close(fd);
+        if (mapped || (sized && st.st_size == 0)) return true;
+#endif
+        ifstream file(filename, ios::binary | ios::ate);
+        if (!file.is_open()) return false;
+        streamoff size = file.tellg();
+        if (size < 0) return false;
+        buffer.resize(static_cast<size_t>(size));
+        file.seekg(0);
+        file.read(buffer.data(), buffer.size());
+        data = buffer.data();
+        length = buffer.size();
+        return true;
+    }
+
+    string_view contents() const { return string_view(data, length); }
+};
+
+#if IMS_HAVE_POSIX_IO
+// Write all of data to fd, retrying short and interrupted writes
+static bool writeAll(int fd, string_view data) {
+    while (!data.empty()) {
+        ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+    return true;
+}
+
+// Flush a file's data to disk
+static bool syncFile(int fd) {
+#if defined(__linux__)
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+// Make a rename in the directory of filename durable
+static void syncParentDirectory(const string& filename) {
+    size_t slash = filename.rfind('/');
+    string dir = (slash == string::npos) ? "." : filename.substr(0, slash + 1);
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+}
+#endif
+
+// Replaces a file atomically: data goes to "<name>.tmp", which is synced to
+// disk and renamed over the target, so a crash leaves either the old file or
+// the complete new one. Without commit() the temp file is discarded.
+class AtomicFileWriter {
+private:
+    string target;
+    string temp;
+    bool failed = false;
+#if IMS_HAVE_POSIX_IO
+    int fd = -1;
+#else
+    ofstream out;
+#endif
+
+    void discard() {
+#if IMS_HAVE_POSIX_IO
+        if (fd < 0) return;
+        ::close(fd);
+        fd = -1;
+#else
+        if (!out.is_open()) return;
+        out.close();
+#endif
+        std::remove(temp.c_str());
     }
 
 public:
-    // Constructor
-    InventoryManager() {
-        loadFromFiles();
+    AtomicFileWriter() = default;
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+    ~AtomicFileWriter() { discard(); }
+
+    bool open(const string& filename) {
+        discard();
+        target = filename;
+        temp = filename + ".tmp";
+        failed = false;
+#if IMS_HAVE_POSIX_IO
+        fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        return fd >= 0;
+#else
+        out.open(temp);
+        return out.is_open();
+#endif
     }
 
-    // Destructor
-    ~InventoryManager() {
-        saveToFiles();
+    void write(string_view data) {
+        if (failed) return;
+#if IMS_HAVE_POSIX_IO
+        failed = !writeAll(fd, data);
+#else
+        failed = !out.write(data.data(), data.size());
+#endif
     }
 
-    // Add product to inventory
-    void addProduct(unique_ptr<Product> product) {
-        // Check if product ID already exists
-        for (const auto& p : inventory) {
-            if (p->getProductId() == product->getProductId()) {
-                cout << "Product with ID " << product->getProductId() 
-                     << " already exists! Use update function instead.\n";
-                return;
-            }
+    // Sync and rename over the target; false leaves the target untouched
+    bool commit() {
+#if IMS_HAVE_POSIX_IO
+        if (fd < 0) return false;
+        failed = failed || !syncFile(fd);
+        failed = (::close(fd) != 0) || failed;
+        fd = -1;
+#else
+        if (!out.is_open()) return false;
+        out.close();
+        failed = failed || out.fail();
+#endif
+        if (failed || std::rename(temp.c_str(), target.c_str()) != 0) {
+            std::remove(temp.c_str());
+            return false;
         }
-        inventory.push_back(move(product));
-        cout << "Product added successfully!\n";
+#if IMS_HAVE_POSIX_IO
+        syncParentDirectory(target);
+#endif
+        return true;
+    }
+};
+
+// Append-only file whose appends are on disk when append() returns. Opened
+// on first use, so an unused log never creates its file.
+class SyncedAppendFile {
+private:
+    string filename;
+#if IMS_HAVE_POSIX_IO
+    int fd = -1;
+#else
+    ofstream out;
+#endif
+
+public:
+    explicit SyncedAppendFile(string name) : filename(move(name)) {}
+    SyncedAppendFile(const SyncedAppendFile&) = delete;
+    SyncedAppendFile& operator=(const SyncedAppendFile&) = delete;
+    ~SyncedAppendFile() { close(); }
+
+    bool append(string_view data) {
+#if IMS_HAVE_POSIX_IO
+        if (fd < 0) {
+            fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd < 0) return false;
+        }
+        return writeAll(fd, data) && syncFile(fd);
+#else
+        if (!out.is_open()) out.open(filename, ios::app);
+        return out.write(data.data(), data.size()).flush().good();
+#endif
     }
 
-    // Search product by ID
-    Product* searchById(const string& id) {
-        auto it = find_if(inventory.begin(), inventory.end(),
-            [&id](const unique_ptr<Product>& p) {
-                return p->getProductId() == id;
-            });
-        return (it != inventory.end()) ? it->get() : nullptr;
+    // Close the file, e.g. before it is renamed or removed
+    void close() {
+#if IMS_HAVE_POSIX_IO
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#else
+        if (out.is_open()) out.close();
+#endif
     }
+};
 
-    // Update product details
-    void updateProduct(const string& id) {
-        Product* product = searchById(id);
-        if (!product) {
-            cout << "Product with ID " << id << " not found!\n";
-            return;
+// Fast 64-bit checksum for snapshot integrity (not cryptographic). Four
+// independent multiply-rotate lanes run over 32-byte stripes; input can
+// arrive in blocks of any size.
+class SnapshotChecksum {
+private:
+    static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+
+    uint64_t lanes[4] = {PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1};
+    unsigned char pending[32];
+    size_t pendingBytes = 0;
+    uint64_t total = 0;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    void stripe(const unsigned char* p) {
+        for (int k = 0; k < 4; k++) {
+            uint64_t word;
+            memcpy(&word, p + 8 * k, 8);
+            lanes[k] = rotl(lanes[k] + word * PRIME2, 31) * PRIME1;
         }
+    }
 
-        cout << "\nCurrent product details:\n";
-        cout << left << setw(12) << "ID" << setw(20) << "Name" 
-             << setw(12) << "Category" << setw(10) << "Price" 
-             << setw(8) << "Stock" << endl;
-        cout << string(70, '-') << endl;
-        product->displayDetails();
+public:
+    void update(string_view data) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+        size_t n = data.size();
+        total += n;
+        if (pendingBytes > 0) {
+            size_t take = min(n, sizeof(pending) - pendingBytes);
+            memcpy(pending + pendingBytes, p, take);
+            pendingBytes += take;
+            p += take;
+            n -= take;
+            if (pendingBytes < sizeof(pending)) return;
+            stripe(pending);
+            pendingBytes = 0;
+        }
+        for (; n >= sizeof(pending); p += sizeof(pending), n -= sizeof(pending)) stripe(p);
+        memcpy(pending, p, n);
+        pendingBytes = n;
+    }
 
-        int choice;
-        cout << "\nWhat would you like to update?\n";
-        cout << "1. Name\n2. Price\n3. Quantity\n4. Category\n";
-        cout << "Enter choice: ";
-        cin >> choice;
+    uint64_t finish() const {
+        uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18) + total;
+        for (size_t i = 0; i < pendingBytes; i++) h = rotl(h ^ (pending[i] * PRIME1), 11) * PRIME2;
+        h ^= h >> 33;
+        h *= PRIME2;
+        return h ^ (h >> 29);
+    }
+};
 
-        switch (choice) {
-            case 1: {
-                string newName;
-                cout << "Enter new name: ";
-                cin.ignore();
-                getline(cin, newName);
-                product->setName(newName);
-                break;
-            }
-            case 2: {
-                double newPrice;
-                cout << "Enter new price: ";
-                cin >> newPrice;
-                product->setPrice(newPrice);
+// Binary inventory snapshot, version 2. Sections are 8-byte aligned and
+// stored in native byte order:
+//   SnapshotHeader
+//   StringRef[categoryCount]     category names
+//   uint8[count]  layout         built-in category of the product type
+//   uint8[count]  category       index into the category names
+//   uint8[count]  flag           organic / prescription required
+//   int64[count] price in cents, int32[count] quantity, int32[count] warranty
+//   StringRef[count] x 4         id, name, text1 (brand, expiry or
+//                                manufacturer), text2 (medicine expiry)
+//   heap                         string bytes
+//   SnapshotTrailer              heap size, then a checksum of every byte
+//                                before the checksum
+// The header records each category CSV file's size and modification time
+// when the snapshot was taken; a snapshot that no longer matches is ignored.
+struct SnapshotFileStamp {
+    uint64_t size = UINT64_MAX;   // UINT64_MAX when the file did not exist
+    int64_t modified = 0;
+};
+
+struct SnapshotHeader {
+    static constexpr char MAGIC[8] = {'I', 'M', 'S', 'S', 'N', 'A', 'P', '\0'};
+    static constexpr uint32_t VERSION = 2;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t categoryCount;
+    uint64_t productCount;
+    SnapshotFileStamp files[3];
+};
+
+struct SnapshotStringRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotTrailer {
+    uint64_t heapBytes;
+    uint64_t checksum;
+};
+
+// Byte offsets of every snapshot section
+struct SnapshotLayout {
+    static constexpr size_t STRING_COLUMNS = 4;
+
+    size_t categories, layout, category, flag, price, quantity, warranty;
+    size_t strings[STRING_COLUMNS];
+    size_t heap, trailer, total;
+
+    static size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+    SnapshotLayout(size_t count, size_t categoryCount, size_t heapBytes) {
+        size_t at = sizeof(SnapshotHeader);
+        auto section = [&at](size_t bytes) {
+            size_t start = at;
+            at += align8(bytes);
+            return start;
+        };
+        categories = section(categoryCount * sizeof(SnapshotStringRef));
+        layout = section(count);
+        category = section(count);
+        flag = section(count);
+        price = section(count * sizeof(Cents));
+        quantity = section(count * sizeof(int32_t));
+        warranty = section(count * sizeof(int32_t));
+        for (size_t& column : strings) column = section(count * sizeof(SnapshotStringRef));
+        heap = section(heapBytes);
+        trailer = section(sizeof(SnapshotTrailer));
+        total = at;
+    }
+};
+
+// Size and modification time of a file, for telling whether a snapshot
+// still matches it
+static SnapshotFileStamp fileStamp(const string& filename) {
+    SnapshotFileStamp stamp;
+    error_code ec;
+    uintmax_t size = filesystem::file_size(filename, ec);
+    if (ec) return stamp;
+    auto modified = filesystem::last_write_time(filename, ec);
+    stamp.size = size;
+    stamp.modified = ec ? 0 : static_cast<int64_t>(modified.time_since_epoch().count());
+    return stamp;
+}
+
+// Splits CSV records out of a buffer without copying. Unquoted fields and
+// plainly quoted fields are views into the buffer; only fields containing ""
+// escapes are unescaped into scratch storage owned by the reader. A quote only
+// starts quoting at the beginning of a field, and quoted fields may span lines.
+// Fields stay valid until the next call to nextRecord().
+class CsvReader {
+private:
+    struct FieldRef {
+        const char* ptr;     // Into the buffer, or nullptr if unescaped into scratch
+        size_t offset;       // Offset into scratch when ptr is nullptr
+        size_t length;
+    };
+
+    const char* begin;
+    const char* pos;
+    const char* end;
+    size_t nextLine;
+    size_t line = 0;
+    size_t recordStart = 0;
+    bool unterminated = false;
+    vector<FieldRef> refs;
+    vector<string_view> fields;
+    string scratch;
+
+    static bool isFieldEnd(const char* p, const char* end) {
+        return p == end || *p == ',' || *p == '\n' || *p == '\r';
+    }
+
+    // Slow path for quoted fields containing "" escapes or trailing text
+    // after the closing quote; the unescaped value goes into scratch
+    void parseQuotedField(const char* start) {
+        size_t offset = scratch.size();
+        bool inQuotes = true;
+        const char* p = start + 1;
+        for (; p != end; ++p) {
+            char c = *p;
+            if (inQuotes) {
+                if (c == '"') {
+                    if (p + 1 != end && p[1] == '"') {
+                        scratch += '"';
+                        ++p;
+                    } else {
+                        inQuotes = false;
+                    }
+                    continue;
+                }
+                if (c == '\n') nextLine++;
+            } else if (c == ',' || c == '\n') {
                 break;
             }
-            case 3: {
-                int newQuantity;
-                cout << "Enter new quantity: ";
-                cin >> newQuantity;
-                product->setQuantity(newQuantity);
-                break;
+            scratch += c;
+        }
+        if (inQuotes) unterminated = true;
+        size_t len = scratch.size() - offset;
+        if (p != end && *p == '\n' && len > 0 && scratch.back() == '\r') {
+            scratch.pop_back();
+            len--;
+        }
+        refs.push_back(FieldRef{nullptr, offset, len});
+        pos = p;
+    }
+
+public:
+    CsvReader(string_view data, size_t firstLine = 1)
+        : begin(data.data()), pos(data.data()), end(data.data() + data.size()), nextLine(firstLine) {}
+
+    // Advance to the next non-empty record; returns false at end of input
+    bool nextRecord() {
+        refs.clear();
+        fields.clear();
+        scratch.clear();
+        unterminated = false;
+
+        // Skip blank lines like the getline-based loader did
+        while (pos != end && (*pos == '\n' || *pos == '\r')) {
+            if (*pos == '\n') nextLine++;
+            ++pos;
+        }
+        recordStart = pos - begin;
+        if (pos == end) return false;
+        line = nextLine;
+
+        while (true) {
+            const char* start = pos;
+            if (start != end && *start == '"') {
+                // Plainly quoted fields can still be served from the buffer
+                const char* close = static_cast<const char*>(memchr(start + 1, '"', end - start - 1));
+                if (close && isFieldEnd(close + 1, end)) {
+                    for (const char* q = start + 1; q != close; ++q) {
+                        if (*q == '\n') nextLine++;
+                    }
+                    refs.push_back(FieldRef{start + 1, 0, static_cast<size_t>(close - start - 1)});
+                    pos = close + 1;
+                    if (pos != end && *pos == '\r' && pos + 1 != end && pos[1] == '\n') ++pos;
+                } else {
+                    parseQuotedField(start);
+                }
+            } else {
+                const char* p = start;
+                while (p != end && *p != ',' && *p != '\n') ++p;
+                size_t len = p - start;
+                if (p != end && *p == '\n' && len > 0 && start[len - 1] == '\r') len--;
+                refs.push_back(FieldRef{start, 0, len});
+                pos = p;
             }
-            case 4: {
-                string newCategory;
-                cout << "Enter new category: ";
-                cin.ignore();
-                getline(cin, newCategory);
-                product->setCategory(newCategory);
+
+            if (pos == end) break;
+            if (*pos == ',') {
+                ++pos;
+                continue;
+            }
+            // End of record
+            nextLine++;
+            ++pos;
+            break;
+        }
+
+        fields.reserve(refs.size());
+        for (const FieldRef& ref : refs) {
+            fields.push_back(ref.ptr ? string_view(ref.ptr, ref.length)
+                                     : string_view(scratch.data() + ref.offset, ref.length));
+        }
+        return true;
+    }
+
+    const vector<string_view>& getFields() const { return fields; }
+    size_t getLineNumber() const { return line; }
+    // Offset of the record last returned (or of the end, once exhausted)
+    size_t getRecordOffset() const { return recordStart; }
+    // Offset where the next record will be searched for
+    size_t getOffset() const { return pos - begin; }
+    bool hasUnterminatedQuote() const { return unterminated; }
+};
+
+// Exception-free numeric field parsing; surrounding blanks are ignored
+static string_view trimField(string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+template <typename T>
+static bool parseNumberField(string_view s, T& out) {
+    s = trimField(s);
+    if (!s.empty() && s.front() == '+') s.remove_prefix(1);
+    if (s.empty()) return false;
+    auto result = from_chars(s.data(), s.data() + s.size(), out);
+    return result.ec == errc() && result.ptr == s.data() + s.size();
+}
+
+// A price in dollars ("12", "12.5", "12.500000") as cents, rounded half up
+// past the second decimal; false unless it is within [0, MAX_PRICE_CENTS]
+static bool parsePriceField(string_view s, Cents& out) {
+    s = trimField(s);
+    if (!s.empty() && s.front() == '+') s.remove_prefix(1);
+    size_t point = s.find('.');
+    string_view whole = s.substr(0, point);
+    string_view fraction = point == string_view::npos ? string_view() : s.substr(point + 1);
+    if (whole.empty() && fraction.empty()) return false;
+    auto isDigit = [](char c) { return c >= '0' && c <= '9'; };
+    if (!all_of(whole.begin(), whole.end(), isDigit) || !all_of(fraction.begin(), fraction.end(), isDigit)) {
+        return false;
+    }
+    while (whole.size() > 1 && whole.front() == '0') whole.remove_prefix(1);
+    if (whole.size() > 9) return false; // Beyond MAX_PRICE_CENTS
+    Cents cents = 0;
+    for (char c : whole) cents = cents * 10 + (c - '0');
+    for (size_t i = 0; i < 2; i++) cents = cents * 10 + (i < fraction.size() ? fraction[i] - '0' : 0);
+    if (fraction.size() > 2 && fraction[2] >= '5') cents++;
+    if (cents > MAX_PRICE_CENTS) return false;
+    out = cents;
+    return true;
+}
+
+// Outcome of loading one category file
+struct CsvLoadReport {
+    static constexpr size_t MAX_REPORTED_ERRORS = 20;
+
+    string filename;
+    size_t rowsLoaded = 0;
+    size_t rowsRejected = 0;
+    vector<string> errors; // First MAX_REPORTED_ERRORS problems, for display
+
+    void reject(size_t line, const string& reason) {
+        rowsRejected++;
+        if (errors.size() < MAX_REPORTED_ERRORS) {
+            errors.push_back(filename + ":" + to_string(line) + ": " + reason);
+        }
+    }
+};
+
+// Run task(i) for every i in [0, count) on a pool of up to `threads` workers
+template <typename Task>
+static void runParallel(size_t count, unsigned threads, Task&& task) {
+    size_t workers = min<size_t>(threads, count);
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+    atomic<size_t> next{0};
+    vector<thread> pool;
+    for (size_t w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) task(i);
+        });
+    }
+    for (thread& worker : pool) worker.join();
+}
+
+// Append-only string storage. Strings are copied once into large blocks and
+// deduplicated, so interned views stay valid until the arena is cleared.
+class StringArena {
+private:
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+    vector<unique_ptr<char[]>> blocks;
+    vector<unique_ptr<char[]>> largeBlocks;
+    size_t blockUsed = BLOCK_SIZE;
+    unordered_set<string_view> interned;
+
+public:
+    StringArena() = default;
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+    StringArena(StringArena&&) = default;
+    StringArena& operator=(StringArena&&) = default;
+
+    string_view intern(string_view text) {
+        auto it = interned.find(text);
+        if (it != interned.end()) return *it;
+
+        char* storage;
+        if (text.size() > BLOCK_SIZE / 4) {
+            // Oversized strings get a block of their own
+            largeBlocks.push_back(make_unique<char[]>(text.size()));
+            storage = largeBlocks.back().get();
+        } else {
+            if (blocks.empty() || blockUsed + text.size() > BLOCK_SIZE) {
+                blocks.push_back(make_unique<char[]>(BLOCK_SIZE));
+                blockUsed = 0;
+            }
+            storage = blocks.back().get() + blockUsed;
+            blockUsed += text.size();
+        }
+        memcpy(storage, text.data(), text.size());
+        string_view view(storage, text.size());
+        interned.insert(view);
+        return view;
+    }
+
+    void clear() {
+        blocks.clear();
+        largeBlocks.clear();
+        interned.clear();
+        blockUsed = BLOCK_SIZE;
+    }
+};
+
+// Case-folded substring index over product names, kept in step with the
+// inventory vector's slots. Every name is split into trigrams with a posting
+// list of the names containing each; a query walks the shortest posting list
+// of its trigrams and confirms candidates against the folded name. Removed
+// names leave stale postings that are purged once they pile up.
+//
+// Prefix (autocomplete) queries binary-search a list of names sorted by
+// folded text. Names added since the last prefix query wait unsorted and are
+// merged in by the next one, so bulk loads never pay for ordering.
+class ProductNameIndex {
+private:
+    struct Doc {
+        size_t slot;          // Inventory slot, or DEAD once removed
+        string_view folded;   // Lowercased name, interned in foldedNames
+    };
+
+    static constexpr size_t DEAD = ~size_t(0);
+    static constexpr size_t MIN_PURGE = 1024;
+
+    StringArena foldedNames;
+    vector<Doc> docs;
+    vector<uint32_t> slotDocs;     // Doc of each inventory slot
+    vector<uint32_t> freeDocs;     // Dead docs with no references left
+    size_t staleDocs = 0;          // Dead docs that may still be referenced
+    unordered_map<uint32_t, vector<uint32_t>> postings;
+    vector<uint32_t> gramScratch;
+    string foldScratch;
+
+    // Docs ordered by folded name, then the ones not yet merged in
+    mutable vector<uint32_t> byName;
+    mutable vector<uint32_t> unsortedNames;
+
+    static char foldChar(char c) { return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c; }
+
+    static void fold(string_view text, string& out) {
+        out.assign(text.data(), text.size());
+        for (char& c : out) c = foldChar(c);
+    }
+
+    static uint32_t trigram(const char* p) {
+        return uint32_t(uint8_t(p[0])) << 16 | uint32_t(uint8_t(p[1])) << 8 | uint8_t(p[2]);
+    }
+
+    // Distinct trigrams of folded text
+    static void collectTrigrams(string_view folded, vector<uint32_t>& grams) {
+        grams.clear();
+        for (size_t i = 0; i + 3 <= folded.size(); i++) grams.push_back(trigram(folded.data() + i));
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    }
+
+    bool nameLess(uint32_t a, uint32_t b) const { return docs[a].folded < docs[b].folded; }
+
+    uint32_t newDoc(size_t slot, string_view name) {
+        uint32_t doc;
+        if (!freeDocs.empty()) {
+            doc = freeDocs.back();
+            freeDocs.pop_back();
+        } else {
+            doc = uint32_t(docs.size());
+            docs.push_back(Doc{DEAD, string_view()});
+        }
+        fold(name, foldScratch);
+        docs[doc].slot = slot;
+        docs[doc].folded = foldedNames.intern(foldScratch);
+        collectTrigrams(docs[doc].folded, gramScratch);
+        for (uint32_t gram : gramScratch) postings[gram].push_back(doc);
+        unsortedNames.push_back(doc);
+        return doc;
+    }
+
+    void killDoc(uint32_t doc) {
+        docs[doc].slot = DEAD;
+        if (++staleDocs >= MIN_PURGE && staleDocs * 4 >= docs.size()) purgeStale();
+    }
+
+    // Drop dead docs from every posting list and name list so their ids can
+    // be reused
+    void purgeStale() {
+        auto dead = [this](uint32_t doc) { return docs[doc].slot == DEAD; };
+        for (auto it = postings.begin(); it != postings.end();) {
+            vector<uint32_t>& list = it->second;
+            list.erase(remove_if(list.begin(), list.end(), dead), list.end());
+            it = list.empty() ? postings.erase(it) : next(it);
+        }
+        byName.erase(remove_if(byName.begin(), byName.end(), dead), byName.end());
+        unsortedNames.erase(remove_if(unsortedNames.begin(), unsortedNames.end(), dead), unsortedNames.end());
+        freeDocs.clear();
+        for (uint32_t doc = 0; doc < docs.size(); doc++) {
+            if (dead(doc)) freeDocs.push_back(doc);
+        }
+        staleDocs = 0;
+    }
+
+    // Fold names added since the last prefix query into byName
+    void mergeUnsortedNames() const {
+        if (unsortedNames.empty()) return;
+        auto less = [this](uint32_t a, uint32_t b) { return nameLess(a, b); };
+        sort(unsortedNames.begin(), unsortedNames.end(), less);
+        size_t middle = byName.size();
+        byName.insert(byName.end(), unsortedNames.begin(), unsortedNames.end());
+        inplace_merge(byName.begin(), byName.begin() + middle, byName.end(), less);
+        unsortedNames.clear();
+    }
+
+public:
+    void clear() {
+        foldedNames.clear();
+        docs.clear();
+        slotDocs.clear();
+        freeDocs.clear();
+        postings.clear();
+        byName.clear();
+        unsortedNames.clear();
+        staleDocs = 0;
+    }
+
+    void reserve(size_t n) {
+        docs.reserve(n);
+        slotDocs.reserve(n);
+        unsortedNames.reserve(n);
+    }
+
+    // Index the name of the product appended at the end of the inventory
+    void add(string_view name) {
+        slotDocs.push_back(newDoc(slotDocs.size(), name));
+    }
+
+    // The product in slot was renamed
+    void rename(size_t slot, string_view name) {
+        killDoc(slotDocs[slot]);
+        slotDocs[slot] = newDoc(slot, name);
+    }
+
+    // Mirror of the inventory's swap-and-pop: drop slot's name and move the
+    // last slot into it
+    void removeSlot(size_t slot) {
+        killDoc(slotDocs[slot]);
+        if (slot + 1 != slotDocs.size()) {
+            slotDocs[slot] = slotDocs.back();
+            docs[slotDocs[slot]].slot = slot;
+        }
+        slotDocs.pop_back();
+    }
+
+    // Slots of products whose name contains term, ignoring ASCII case, in
+    // slot order
+    vector<size_t> findSubstring(string_view term) const {
+        string folded;
+        fold(term, folded);
+        vector<size_t> slots;
+        if (folded.size() < 3) {
+            // Too short for a trigram; the folded names still save re-folding
+            for (uint32_t doc : slotDocs) {
+                if (docs[doc].folded.find(folded) != string_view::npos) slots.push_back(docs[doc].slot);
+            }
+            return slots;
+        }
+
+        vector<uint32_t> grams;
+        collectTrigrams(folded, grams);
+        const vector<uint32_t>* shortest = nullptr;
+        for (uint32_t gram : grams) {
+            auto it = postings.find(gram);
+            if (it == postings.end()) return slots;
+            if (!shortest || it->second.size() < shortest->size()) shortest = &it->second;
+        }
+        for (uint32_t doc : *shortest) {
+            if (docs[doc].slot != DEAD && docs[doc].folded.find(folded) != string_view::npos) {
+                slots.push_back(docs[doc].slot);
+            }
+        }
+        sort(slots.begin(), slots.end());
+        return slots;
+    }
+
+    // Slots of up to limit products whose name starts with prefix, ignoring
+    // ASCII case, in name order
+    vector<size_t> findPrefix(string_view prefix, size_t limit) const {
+        mergeUnsortedNames();
+        string folded;
+        fold(prefix, folded);
+        vector<size_t> slots;
+        auto it = lower_bound(byName.begin(), byName.end(), folded,
+            [this](uint32_t doc, const string& key) { return docs[doc].folded < key; });
+        for (; it != byName.end() && slots.size() < limit; ++it) {
+            const Doc& doc = docs[*it];
+            if (doc.folded.compare(0, folded.size(), folded) != 0) break;
+            if (doc.slot != DEAD) slots.push_back(doc.slot);
+        }
+        return slots;
+    }
+};
+
+// Ordered index from a numeric key (price, quantity, expiry day) to
+// inventory slots, for range queries. Entries sit in one large sorted array
+// plus a small sorted array of recent inserts that is merged in once it
+// outgrows a multiple of the square root of the index; erased entries are
+// only marked dead until then. A range query costs a binary search in each array plus
+// the entries in the range.
+template <typename Key>
+class OrderedSlotIndex {
+private:
+    struct Entry {
+        Key key;
+        uint32_t slot;
+        bool live;
+
+        bool operator<(const Entry& other) const {
+            return key < other.key || (key == other.key && slot < other.slot);
+        }
+    };
+
+    // Recent inserts are merged in past RECENT_PER_ROOT times the square root
+    // of the index size, balancing insert shifts against merge passes
+    static constexpr size_t MIN_RECENT = 256;
+    static constexpr size_t RECENT_PER_ROOT = 4;
+
+    vector<Entry> sorted;
+    vector<Entry> recent;
+    vector<Entry> scratch;
+    size_t deadEntries = 0;
+
+    // Fold recent into sorted in one pass, dropping dead entries
+    void merge() {
+        scratch.clear();
+        scratch.reserve(sorted.size() - deadEntries + recent.size());
+        auto b = recent.begin();
+        for (const Entry& entry : sorted) {
+            if (!entry.live) continue;
+            while (b != recent.end() && *b < entry) scratch.push_back(*b++);
+            scratch.push_back(entry);
+        }
+        scratch.insert(scratch.end(), b, recent.end());
+        sorted.swap(scratch);
+        recent.clear();
+        deadEntries = 0;
+    }
+
+public:
+    void clear() {
+        sorted.clear();
+        recent.clear();
+        scratch.clear();
+        deadEntries = 0;
+    }
+
+    // Bulk load: append every entry, then sortAppended() once
+    void append(Key key, size_t slot) {
+        sorted.push_back(Entry{key, uint32_t(slot), true});
+    }
+
+    void sortAppended() { sort(sorted.begin(), sorted.end()); }
+
+    void insert(Key key, size_t slot) {
+        Entry entry{key, uint32_t(slot), true};
+        recent.insert(upper_bound(recent.begin(), recent.end(), entry), entry);
+        if (recent.size() > max(MIN_RECENT, RECENT_PER_ROOT * size_t(sqrt(double(sorted.size()))))) merge();
+    }
+
+    void erase(Key key, size_t slot) {
+        Entry entry{key, uint32_t(slot), true};
+        auto inRecent = lower_bound(recent.begin(), recent.end(), entry);
+        if (inRecent != recent.end() && !(entry < *inRecent)) {
+            recent.erase(inRecent);
+            return;
+        }
+        auto inSorted = lower_bound(sorted.begin(), sorted.end(), entry);
+        if (inSorted == sorted.end() || entry < *inSorted || !inSorted->live) return;
+        inSorted->live = false;
+        if (++deadEntries * 4 > sorted.size()) merge();
+    }
+
+    // Call visit(slot) for every entry with low <= key <= high, in key order
+    template <typename Visit>
+    void forRange(Key low, Key high, Visit&& visit) const {
+        if (high < low) return;
+        Entry first{low, 0, true};
+        auto a = lower_bound(sorted.begin(), sorted.end(), first);
+        auto b = lower_bound(recent.begin(), recent.end(), first);
+        while (true) {
+            while (a != sorted.end() && !a->live) ++a;
+            bool moreA = a != sorted.end() && !(high < a->key);
+            bool moreB = b != recent.end() && !(high < b->key);
+            if (!moreA && !moreB) return;
+            if (moreA && (!moreB || *a < *b)) {
+                visit(size_t(a++->slot));
+            } else {
+                visit(size_t(b++->slot));
+            }
+        }
+    }
+};
+
+// Indexed binary min-heap of inventory slots by expiry day, soonest on top.
+// The heap position of every slot is kept, so a slot leaves or changes key
+// in O(log n) wherever it sits in the heap.
+class ExpiryHeap {
+private:
+    struct Entry {
+        int32_t day;
+        uint32_t slot;
+
+        bool operator<(const Entry& other) const {
+            return day < other.day || (day == other.day && slot < other.slot);
+        }
+    };
+
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    vector<Entry> heap;
+    vector<uint32_t> positions;   // Heap position of each slot, or NONE
+
+    void place(size_t i, const Entry& entry) {
+        heap[i] = entry;
+        positions[entry.slot] = uint32_t(i);
+    }
+
+    void siftUp(size_t i) {
+        Entry entry = heap[i];
+        while (i > 0 && entry < heap[(i - 1) / 2]) {
+            place(i, heap[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+        place(i, entry);
+    }
+
+    void siftDown(size_t i) {
+        Entry entry = heap[i];
+        while (true) {
+            size_t child = 2 * i + 1;
+            if (child >= heap.size()) break;
+            if (child + 1 < heap.size() && heap[child + 1] < heap[child]) child++;
+            if (!(heap[child] < entry)) break;
+            place(i, heap[child]);
+            i = child;
+        }
+        place(i, entry);
+    }
+
+    void track(size_t slot) {
+        if (slot >= positions.size()) positions.resize(slot + 1, NONE);
+    }
+
+public:
+    void clear() {
+        heap.clear();
+        positions.clear();
+    }
+
+    bool empty() const { return heap.empty(); }
+    int32_t topDay() const { return heap.front().day; }
+    size_t topSlot() const { return heap.front().slot; }
+
+    // Bulk load: append every slot, then heapify() once
+    void append(int32_t day, size_t slot) {
+        track(slot);
+        positions[slot] = uint32_t(heap.size());
+        heap.push_back(Entry{day, uint32_t(slot)});
+    }
+
+    void heapify() {
+        for (size_t i = heap.size() / 2; i-- > 0;) siftDown(i);
+    }
+
+    void insert(int32_t day, size_t slot) {
+        append(day, slot);
+        siftUp(heap.size() - 1);
+    }
+
+    // Take slot out of the heap; a slot that is not in it is ignored
+    void erase(size_t slot) {
+        if (slot >= positions.size() || positions[slot] == NONE) return;
+        size_t i = positions[slot];
+        positions[slot] = NONE;
+        Entry last = heap.back();
+        heap.pop_back();
+        if (i == heap.size()) return;
+        place(i, last);
+        siftUp(i);
+        siftDown(positions[last.slot]);
+    }
+
+    // Call visit(slot, day) for every entry due on or before lastDay, in heap
+    // order. Subtrees below a later day are skipped, so this costs the
+    // number of entries visited.
+    template <typename Visit>
+    void forEachDue(int32_t lastDay, Visit&& visit) const {
+        vector<size_t> pending;
+        if (!heap.empty()) pending.push_back(0);
+        while (!pending.empty()) {
+            size_t i = pending.back();
+            pending.pop_back();
+            if (heap[i].day > lastDay) continue;
+            visit(size_t(heap[i].slot), heap[i].day);
+            if (2 * i + 1 < heap.size()) pending.push_back(2 * i + 1);
+            if (2 * i + 2 < heap.size()) pending.push_back(2 * i + 2);
+        }
+    }
+};
+
+// Per-category and overall totals produced by a stock scan
+struct CategoryTotals {
+    size_t products = 0;
+    long long items = 0;
+    MoneyTotal value;
+    size_t lowStock = 0;
+};
+
+struct StockSummary {
+    vector<CategoryTotals> categories; // Indexed by category id
+    CategoryTotals overall;
+};
+
+// What a stock report shows: the totals and, in inventory order, the
+// products with less stock than the low-stock threshold
+struct StockReport {
+    StockSummary summary;
+    vector<const Product*> lowStock;
+};
+
+// A product whose expired stock was pulled, with the units taken off
+struct PulledStock {
+    Product* product;
+    int units;
+};
+
+// Running stock totals and the set of low-stock slots, kept up to date one
+// product at a time so a report costs O(categories + low-stock items)
+// instead of a scan of the inventory
+class StockTotals {
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    StockSummary summary;
+    vector<uint32_t> lowSlots;       // Unordered
+    vector<uint32_t> lowPositions;   // Index of each slot in lowSlots, or NONE
+
+    void count(CategoryId category, Cents value, int quantity, bool low, int sign) {
+        if (category >= summary.categories.size()) summary.categories.resize(size_t(category) + 1);
+        for (CategoryTotals* totals : {&summary.categories[category], &summary.overall}) {
+            totals->products += sign;
+            totals->items += sign * static_cast<long long>(quantity);
+            if (sign > 0) totals->value.add(value);
+            else totals->value.subtract(value);
+            totals->lowStock += sign * int(low);
+        }
+    }
+
+public:
+    void clear() {
+        summary = StockSummary();
+        summary.categories.resize(CategoryRegistry::count());
+        lowSlots.clear();
+        lowPositions.clear();
+    }
+
+    // Count a product at slot with the given price and stock in, or out
+    void add(size_t slot, CategoryId category, Cents price, int quantity, int lowStockThreshold) {
+        bool low = quantity < lowStockThreshold;
+        count(category, price * quantity, quantity, low, 1);
+        if (!low) return;
+        if (slot >= lowPositions.size()) lowPositions.resize(slot + 1, NONE);
+        lowPositions[slot] = uint32_t(lowSlots.size());
+        lowSlots.push_back(uint32_t(slot));
+    }
+
+    void remove(size_t slot, CategoryId category, Cents price, int quantity, int lowStockThreshold) {
+        bool low = quantity < lowStockThreshold;
+        count(category, price * quantity, quantity, low, -1);
+        if (!low || slot >= lowPositions.size() || lowPositions[slot] == NONE) return;
+        uint32_t position = lowPositions[slot];
+        lowPositions[slot] = NONE;
+        uint32_t last = lowSlots.back();
+        lowSlots.pop_back();
+        if (last == slot) return;
+        lowSlots[position] = last;
+        lowPositions[last] = position;
+    }
+
+    // Totals for every registered category
+    StockSummary current() const {
+        StockSummary copy = summary;
+        if (copy.categories.size() < CategoryRegistry::count()) copy.categories.resize(CategoryRegistry::count());
+        return copy;
+    }
+
+    // Low-stock slots in inventory order
+    vector<uint32_t> lowStockSlots() const {
+        vector<uint32_t> slots = lowSlots;
+        sort(slots.begin(), slots.end());
+        return slots;
+    }
+};
+
+// Stock aggregation kernels: one pass over the price, quantity and category
+// columns accumulating per-category product count, items, value and
+// low-stock count into totals (indexed by category id, already sized).
+// Prices are within [0, MAX_PRICE_CENTS], so every row's value fits.
+static void aggregateStockScalar(const Cents* prices, const int32_t* quantities,
+                                 const uint8_t* categoryIds, size_t count, int lowStockThreshold,
+                                 vector<CategoryTotals>& totals) {
+    for (size_t i = 0; i < count; i++) {
+        CategoryTotals& t = totals[categoryIds[i]];
+        t.products++;
+        t.items += quantities[i];
+        t.value.add(prices[i] * quantities[i]);
+        t.lowStock += quantities[i] < lowStockThreshold;
+    }
+}
+
+#if IMS_HAVE_AVX2
+// AVX2 version: eight rows per step, with one set of vector accumulators per
+// category so the loop body has no data-dependent branches. Only used for
+// up to AVX2_MAX_CATEGORIES categories. Values are summed in plain 64-bit
+// lanes; the bits seen in prices and quantities bound every lane's sum
+// afterwards, and in the rare case it could have wrapped the values are
+// summed again with overflow checks.
+static constexpr size_t AVX2_MAX_CATEGORIES = 8;
+
+static unsigned bitWidth(uint64_t value) { return value ? 64 - unsigned(__builtin_clzll(value)) : 0; }
+
+__attribute__((target("avx2")))
+static void aggregateStockAvx2(const Cents* prices, const int32_t* quantities,
+                               const uint8_t* categoryIds, size_t count, int lowStockThreshold,
+                               vector<CategoryTotals>& totals) {
+    const size_t categories = totals.size();
+    __m256i productAcc[AVX2_MAX_CATEGORIES], lowAcc[AVX2_MAX_CATEGORIES];
+    __m256i itemsAcc[AVX2_MAX_CATEGORIES], valueAcc[AVX2_MAX_CATEGORIES];
+    for (size_t c = 0; c < categories; c++) {
+        productAcc[c] = lowAcc[c] = itemsAcc[c] = valueAcc[c] = _mm256_setzero_si256();
+    }
+
+    const __m256i threshold = _mm256_set1_epi32(lowStockThreshold);
+    __m256i priceBits = _mm256_setzero_si256(), quantityBits = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i qty = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(quantities + i));
+        __m256i cat = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(categoryIds + i)));
+        __m256i low = _mm256_cmpgt_epi32(threshold, qty);
+        __m256i qtyLo64 = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(qty));
+        __m256i qtyHi64 = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(qty, 1));
+        __m256i priceLo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prices + i));
+        __m256i priceHi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(prices + i + 4));
+        priceBits = _mm256_or_si256(priceBits, _mm256_or_si256(priceLo, priceHi));
+        quantityBits = _mm256_or_si256(quantityBits, _mm256_abs_epi32(qty));
+        // Signed 32 x 32 -> 64-bit products of the low halves of each lane
+        __m256i valueLo = _mm256_mul_epi32(priceLo, qtyLo64);
+        __m256i valueHi = _mm256_mul_epi32(priceHi, qtyHi64);
+
+        for (size_t c = 0; c < categories; c++) {
+            __m256i match = _mm256_cmpeq_epi32(cat, _mm256_set1_epi32(static_cast<int>(c)));
+            // Masks are -1 per matching lane, so subtracting counts matches
+            productAcc[c] = _mm256_sub_epi32(productAcc[c], match);
+            lowAcc[c] = _mm256_sub_epi32(lowAcc[c], _mm256_and_si256(match, low));
+            __m256i matchLo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(match));
+            __m256i matchHi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(match, 1));
+            itemsAcc[c] = _mm256_add_epi64(itemsAcc[c], _mm256_and_si256(matchLo, qtyLo64));
+            itemsAcc[c] = _mm256_add_epi64(itemsAcc[c], _mm256_and_si256(matchHi, qtyHi64));
+            valueAcc[c] = _mm256_add_epi64(valueAcc[c], _mm256_and_si256(matchLo, valueLo));
+            valueAcc[c] = _mm256_add_epi64(valueAcc[c], _mm256_and_si256(matchHi, valueHi));
+        }
+    }
+
+    // Each lane summed at most i / 4 values below 2^(price bits + quantity
+    // bits); the multiply also needs prices below 2^31
+    alignas(32) uint64_t bits64[4];
+    alignas(32) uint32_t bits32[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bits64), priceBits);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bits32), quantityBits);
+    uint64_t pricesSeen = bits64[0] | bits64[1] | bits64[2] | bits64[3];
+    uint64_t quantitiesSeen = 0;
+    for (uint32_t lane : bits32) quantitiesSeen |= lane;
+    bool valuesExact = bitWidth(pricesSeen) <= 31 &&
+                       bitWidth(pricesSeen) + bitWidth(quantitiesSeen) + bitWidth(i / 4) <= 63;
+
+    for (size_t c = 0; c < categories; c++) {
+        alignas(32) int32_t lanes32[8];
+        alignas(32) int64_t lanes64[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes32), productAcc[c]);
+        for (int32_t lane : lanes32) totals[c].products += static_cast<uint32_t>(lane);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes32), lowAcc[c]);
+        for (int32_t lane : lanes32) totals[c].lowStock += static_cast<uint32_t>(lane);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes64), itemsAcc[c]);
+        for (int64_t lane : lanes64) totals[c].items += lane;
+        if (!valuesExact) continue;
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes64), valueAcc[c]);
+        for (int64_t lane : lanes64) totals[c].value.add(lane);
+    }
+    if (!valuesExact) {
+        for (size_t r = 0; r < i; r++) totals[categoryIds[r]].value.add(prices[r] * quantities[r]);
+    }
+    aggregateStockScalar(prices + i, quantities + i, categoryIds + i, count - i, lowStockThreshold, totals);
+}
+
+static bool cpuSupportsAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+// Pick the fastest kernel this CPU supports
+static void aggregateStock(const Cents* prices, const int32_t* quantities, const uint8_t* categoryIds,
+                           size_t count, int lowStockThreshold, vector<CategoryTotals>& totals) {
+#if IMS_HAVE_AVX2
+    // Per-lane 32-bit counters are safe up to 2^31 rows per lane
+    if (cpuSupportsAvx2() && totals.size() <= AVX2_MAX_CATEGORIES && count / 8 < INT32_MAX) {
+        aggregateStockAvx2(prices, quantities, categoryIds, count, lowStockThreshold, totals);
+        return;
+    }
+#endif
+    aggregateStockScalar(prices, quantities, categoryIds, count, lowStockThreshold, totals);
+}
+
+// Structure-of-arrays copy of the inventory for analytics. Each attribute
+// lives in its own contiguous column and strings are interned in an arena,
+// so aggregate scans stream through memory instead of chasing one heap
+// object per product.
+class ColumnarInventory {
+private:
+    StringArena strings;
+
+public:
+    vector<string_view> productIds;
+    vector<string_view> names;
+    vector<Cents> prices;
+    vector<int32_t> quantities;
+    vector<CategoryId> categoryIds;
+    vector<int32_t> expiryDays;
+    vector<string> categoryNames; // CategoryRegistry id -> name, see syncCategoryNames()
+
+    size_t size() const { return prices.size(); }
+
+    void clear() {
+        productIds.clear();
+        names.clear();
+        prices.clear();
+        quantities.clear();
+        categoryIds.clear();
+        expiryDays.clear();
+        categoryNames.clear();
+        strings.clear();
+    }
+
+    void reserve(size_t n) {
+        productIds.reserve(n);
+        names.reserve(n);
+        prices.reserve(n);
+        quantities.reserve(n);
+        categoryIds.reserve(n);
+        expiryDays.reserve(n);
+    }
+
+    // Registry id for a category name, keeping categoryNames in step
+    CategoryId categoryId(string_view category) {
+        CategoryId id = CategoryRegistry::intern(category);
+        syncCategoryNames();
+        return id;
+    }
+
+    // Cover every registered category so ids index categoryNames directly
+    void syncCategoryNames() {
+        for (size_t id = categoryNames.size(); id < CategoryRegistry::count(); id++) {
+            categoryNames.push_back(CategoryRegistry::name(static_cast<CategoryId>(id)));
+        }
+    }
+
+    void append(string_view id, string_view name, Cents price, int32_t quantity,
+                CategoryId category, int32_t expiry) {
+        productIds.push_back(strings.intern(id));
+        names.push_back(strings.intern(name));
+        prices.push_back(price);
+        quantities.push_back(quantity);
+        categoryIds.push_back(category);
+        expiryDays.push_back(expiry);
+    }
+
+    void append(const Product& product) {
+        append(product.getProductId(), product.getName(), product.getPrice(), product.getQuantity(),
+               product.getCategoryId(), product.getExpiryDays());
+    }
+
+    // Single pass over the numeric columns using the best available kernel
+    StockSummary summarize(int lowStockThreshold) const {
+        StockSummary summary;
+        summary.categories.resize(categoryNames.size());
+        aggregateStock(prices.data(), quantities.data(), categoryIds.data(), size(),
+                       lowStockThreshold, summary.categories);
+        for (const CategoryTotals& totals : summary.categories) {
+            summary.overall.products += totals.products;
+            summary.overall.items += totals.items;
+            summary.overall.value.add(totals.value);
+            summary.overall.lowStock += totals.lowStock;
+        }
+        return summary;
+    }
+
+    // Rows whose expiry falls in [fromDay, toDay]
+    vector<size_t> expiringBetween(int32_t fromDay, int32_t toDay) const {
+        vector<size_t> rows;
+        for (size_t i = 0; i < expiryDays.size(); i++) {
+            if (expiryDays[i] >= fromDay && expiryDays[i] <= toDay) rows.push_back(i);
+        }
+        return rows;
+    }
+};
+
+// Operations whose calls are counted and timed
+enum class StatOp : uint8_t { Load, Save, Lookup, NameSearch, Update, Report, COUNT };
+
+static const char* statOpName(StatOp op) {
+    static const char* names[] = {"load", "save", "lookup", "name_search", "update", "report"};
+    return names[static_cast<size_t>(op)];
+}
+
+// Latency histogram with HDR-style log-linear buckets: values below 16 ns
+// get a bucket each and every power of two above is split into 16, so any
+// recorded latency is known to within 1/16 (about 6%).
+struct LatencyHistogram {
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    array<uint64_t, BUCKETS> counts{};
+    uint64_t calls = 0;        // Every call, timed or not
+    uint64_t count = 0;        // Timed calls, the sum of counts
+    uint64_t totalNanos = 0;
+    uint64_t maxNanos = 0;
+
+    static size_t bucketOf(uint64_t nanos) {
+        if (nanos < SUB_BUCKETS) return size_t(nanos);
+        unsigned shift = 63 - unsigned(__builtin_clzll(nanos)) - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + size_t(nanos >> shift) - SUB_BUCKETS;
+    }
+
+    // Smallest value that falls in a bucket
+    static uint64_t bucketStart(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        unsigned shift = unsigned(bucket / SUB_BUCKETS) - 1;
+        return (uint64_t(SUB_BUCKETS) + bucket % SUB_BUCKETS) << shift;
+    }
+
+    // Latency at quantile q (0-1), as the midpoint of its bucket
+    uint64_t percentile(double q) const {
+        if (count == 0) return 0;
+        uint64_t rank = max<uint64_t>(1, uint64_t(ceil(q * double(count))));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; b++) {
+            seen += counts[b];
+            if (seen < rank) continue;
+            uint64_t low = bucketStart(b);
+            uint64_t high = (b + 1 < BUCKETS) ? bucketStart(b + 1) : low;
+            return min(maxNanos, low + (high - low) / 2);
+        }
+        return maxNanos;
+    }
+
+    double meanNanos() const { return count ? double(totalNanos) / double(count) : 0.0; }
+};
+
+// Merged view of every thread's operation stats
+struct OperationStatsSnapshot {
+    array<LatencyHistogram, size_t(StatOp::COUNT)> operations;
+
+    const LatencyHistogram& operator[](StatOp op) const { return operations[size_t(op)]; }
+};
+
+// Process-wide operation counters and latency histograms. Each thread
+// records into its own block, so recording takes no lock and shares no
+// cache line; snapshot() merges the blocks. A block outlives its thread,
+// keeping the calls it recorded in the totals.
+//
+// Every call is counted but lookups are only timed one call in 256 and
+// updates one in 16: reading the clock stops the CPU from overlapping the
+// cache misses of back-to-back lookups, which would otherwise cost more
+// than the lookups themselves.
+class OperationStats {
+private:
+    static constexpr array<uint32_t, size_t(StatOp::COUNT)> SAMPLE_EVERY = {1, 1, 256, 1, 16, 1};
+
+    struct Counters {
+        array<atomic<uint64_t>, LatencyHistogram::BUCKETS> counts{};
+        atomic<uint64_t> totalNanos{0};
+        atomic<uint64_t> maxNanos{0};
+    };
+
+    // Written only by the owning thread; other threads just read, so plain
+    // relaxed loads and stores stand in for atomic adds. The call counters
+    // share one cache line.
+    struct ThreadBlock {
+        array<atomic<uint64_t>, size_t(StatOp::COUNT)> calls{};
+        array<Counters, size_t(StatOp::COUNT)> operations;
+    };
+
+    static void bump(atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+    static void clearBlock(ThreadBlock& block) {
+        for (auto& calls : block.calls) calls.store(0, memory_order_relaxed);
+        for (Counters& counters : block.operations) {
+            for (auto& count : counters.counts) count.store(0, memory_order_relaxed);
+            counters.totalNanos.store(0, memory_order_relaxed);
+            counters.maxNanos.store(0, memory_order_relaxed);
+        }
+    }
+
+    static void addBlock(ThreadBlock& into, const ThreadBlock& from) {
+        for (size_t op = 0; op < size_t(StatOp::COUNT); op++) {
+            bump(into.calls[op], from.calls[op].load(memory_order_relaxed));
+            Counters& to = into.operations[op];
+            const Counters& counters = from.operations[op];
+            for (size_t b = 0; b < LatencyHistogram::BUCKETS; b++) {
+                bump(to.counts[b], counters.counts[b].load(memory_order_relaxed));
+            }
+            bump(to.totalNanos, counters.totalNanos.load(memory_order_relaxed));
+            to.maxNanos.store(max(to.maxNanos.load(memory_order_relaxed), counters.maxNanos.load(memory_order_relaxed)),
+                              memory_order_relaxed);
+        }
+    }
+
+    // Hands its thread's block back when the thread exits
+    struct BlockOwner {
+        ThreadBlock* block;
+        BlockOwner() : block(nullptr) {}
+        ~BlockOwner() {
+            if (block) instance().retireThreadBlock(block);
+        }
+    };
+
+    mutex blocksMutex;
+    vector<unique_ptr<ThreadBlock>> blocks;
+    vector<unique_ptr<ThreadBlock>> spareBlocks; // Cleared, for the next new thread
+    ThreadBlock retired;                         // Counts of threads that have exited
+    atomic<bool> enabled{true};
+
+    static inline thread_local ThreadBlock* localBlock = nullptr;
+    static inline thread_local BlockOwner localOwner;
+
+    ThreadBlock& addThreadBlock() {
+        lock_guard<mutex> lock(blocksMutex);
+        if (spareBlocks.empty()) {
+            blocks.push_back(make_unique<ThreadBlock>());
+        } else {
+            blocks.push_back(move(spareBlocks.back()));
+            spareBlocks.pop_back();
+        }
+        localBlock = blocks.back().get();
+        localOwner.block = localBlock;
+        return *localBlock;
+    }
+
+    // Fold an exiting thread's counts into retired and keep its block for
+    // reuse, so short-lived worker threads don't each leave one behind
+    void retireThreadBlock(ThreadBlock* block) {
+        lock_guard<mutex> lock(blocksMutex);
+        auto found = find_if(blocks.begin(), blocks.end(), [block](const auto& owned) { return owned.get() == block; });
+        if (found == blocks.end()) return;
+        addBlock(retired, *block);
+        clearBlock(*block);
+        spareBlocks.push_back(move(*found));
+        *found = move(blocks.back());
+        blocks.pop_back();
+        localBlock = nullptr;
+    }
+
+    ThreadBlock& threadBlock() { return localBlock ? *localBlock : addThreadBlock(); }
+
+public:
+    static OperationStats& instance() {
+        static OperationStats stats;
+        return stats;
+    }
+
+    bool isEnabled() const { return enabled.load(memory_order_relaxed); }
+    void setEnabled(bool on) { enabled.store(on, memory_order_relaxed); }
+
+    // Count a call of op; true if this call should be timed
+    bool countCall(StatOp op) {
+        atomic<uint64_t>& calls = threadBlock().calls[size_t(op)];
+        uint64_t before = calls.load(memory_order_relaxed);
+        calls.store(before + 1, memory_order_relaxed);
+        return (before & (SAMPLE_EVERY[size_t(op)] - 1)) == 0;
+    }
+
+    // Take back a call counted by this thread
+    void uncountCall(StatOp op) {
+        atomic<uint64_t>& calls = threadBlock().calls[size_t(op)];
+        uint64_t before = calls.load(memory_order_relaxed);
+        if (before > 0) calls.store(before - 1, memory_order_relaxed);
+    }
+
+    void record(StatOp op, uint64_t nanos) {
+        Counters& counters = threadBlock().operations[size_t(op)];
+        bump(counters.counts[LatencyHistogram::bucketOf(nanos)], 1);
+        bump(counters.totalNanos, nanos);
+        if (nanos > counters.maxNanos.load(memory_order_relaxed)) {
+            counters.maxNanos.store(nanos, memory_order_relaxed);
+        }
+    }
+
+    OperationStatsSnapshot snapshot() {
+        OperationStatsSnapshot merged;
+        lock_guard<mutex> lock(blocksMutex);
+        vector<const ThreadBlock*> sources{&retired};
+        for (const auto& block : blocks) sources.push_back(block.get());
+        for (const ThreadBlock* block : sources) {
+            for (size_t op = 0; op < size_t(StatOp::COUNT); op++) {
+                const Counters& counters = block->operations[op];
+                LatencyHistogram& histogram = merged.operations[op];
+                histogram.calls += block->calls[op].load(memory_order_relaxed);
+                for (size_t b = 0; b < LatencyHistogram::BUCKETS; b++) {
+                    uint64_t count = counters.counts[b].load(memory_order_relaxed);
+                    histogram.counts[b] += count;
+                    histogram.count += count;
+                }
+                histogram.totalNanos += counters.totalNanos.load(memory_order_relaxed);
+                histogram.maxNanos = max(histogram.maxNanos, counters.maxNanos.load(memory_order_relaxed));
+            }
+        }
+        return merged;
+    }
+
+    // Zero every thread's counters; calls in flight may still land
+    void reset() {
+        lock_guard<mutex> lock(blocksMutex);
+        clearBlock(retired);
+        for (const auto& block : blocks) clearBlock(*block);
+    }
+};
+
+// Times the enclosing scope as one call of op
+class OperationTimer {
+private:
+    StatOp op;
+    bool counted;
+    bool timing;
+    chrono::steady_clock::time_point start;
+
+public:
+    explicit OperationTimer(StatOp operation) : op(operation), counted(false), timing(false) {
+        OperationStats& stats = OperationStats::instance();
+        if (!stats.isEnabled()) return;
+        counted = true;
+        timing = stats.countCall(op);
+        if (timing) start = chrono::steady_clock::now();
+    }
+
+    ~OperationTimer() {
+        if (!timing) return;
+        auto nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        OperationStats::instance().record(op, uint64_t(max<int64_t>(0, nanos)));
+    }
+
+    // Neither count nor time the call, e.g. when it hands over to another
+    // timed one
+    void discard() {
+        if (counted) OperationStats::instance().uncountCall(op);
+        counted = timing = false;
+    }
+
+    OperationTimer(const OperationTimer&) = delete;
+    OperationTimer& operator=(const OperationTimer&) = delete;
+};
+
+// Operation stats as JSON: one object per operation with its call count,
+// how many of the calls were timed, and the mean, percentile and maximum
+// latencies of those in nanoseconds
+static string operationStatsJson(const OperationStatsSnapshot& stats) {
+    string out = "{\n";
+    for (size_t op = 0; op < size_t(StatOp::COUNT); op++) {
+        const LatencyHistogram& histogram = stats.operations[op];
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "  \"%s\": {\"calls\": %llu, \"timed\": %llu, \"mean_ns\": %.0f, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+                 "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}%s\n",
+                 statOpName(StatOp(op)), (unsigned long long)histogram.calls, (unsigned long long)histogram.count,
+                 histogram.meanNanos(),
+                 (unsigned long long)histogram.percentile(0.50), (unsigned long long)histogram.percentile(0.90),
+                 (unsigned long long)histogram.percentile(0.99), (unsigned long long)histogram.percentile(0.999),
+                 (unsigned long long)histogram.maxNanos, op + 1 < size_t(StatOp::COUNT) ? "," : "");
+        out += line;
+    }
+    return out + "}\n";
+}
+
+// Outcome of one inventory operation
+enum class OpStatus : uint8_t {
+    Ok,
+    NotFound,        // No product has the ID
+    DuplicateId,     // Add of an ID that is already taken
+    StockOverflow,   // The quantity would leave the int range
+    InvalidPrice,    // Not a number, negative or above MAX_PRICE_CENTS
+    InvalidProduct,  // Add without a product
+    IoError          // A file could not be written. For a change: it was made
+                     // but could not be logged, so it is only durable once
+                     // the next save succeeds
+};
+
+// What pullExpiredStock did. The stock is zeroed either way; IoError means
+// the batch could not be logged, so it is only durable once the next save
+// succeeds.
+struct PullResult {
+    vector<PulledStock> pulled;
+    OpStatus status = OpStatus::Ok;
+};
+
+// One step of InventoryManager::applyBatch
+struct BatchOperation {
+    enum class Kind : uint8_t { Add, AdjustStock, SetPrice, Remove };
+
+    Kind kind = Kind::AdjustStock;
+    string productId;        // Every kind but Add, which uses the product's ID
+    ProductPtr product;      // Add
+    int quantityChange = 0;  // AdjustStock
+    Cents price = 0;         // SetPrice
+
+    string_view id() const { return product ? product->getProductId() : string_view(productId); }
+
+    static BatchOperation add(ProductPtr product) {
+        BatchOperation op;
+        op.kind = Kind::Add;
+        op.product = move(product);
+        return op;
+    }
+
+    static BatchOperation adjustStock(string_view id, int change) {
+        BatchOperation op;
+        op.productId = id;
+        op.quantityChange = change;
+        return op;
+    }
+
+    static BatchOperation setPrice(string_view id, Cents price) {
+        BatchOperation op;
+        op.kind = Kind::SetPrice;
+        op.productId = id;
+        op.price = price;
+        return op;
+    }
+
+    static BatchOperation remove(string_view id) {
+        BatchOperation op;
+        op.kind = Kind::Remove;
+        op.productId = id;
+        return op;
+    }
+};
+
+// What applyBatch did: either every operation took effect (applied) or
+// none did, and statuses says which operations failed
+struct BatchResult {
+    bool applied = false;
+    vector<OpStatus> statuses;   // One per operation, in batch order
+};
+
+// Inventory Manager class
+class InventoryManager {
+    friend class ConcurrentInventory;
+
+private:
+    // Arenas owning the products of the last load; declared before inventory
+    // so they outlive every product pointer during destruction
+    vector<unique_ptr<ProductArena>> loadArenas;
+    vector<ProductPtr> inventory;
+    ProductIdIndex idIndex;
+    ProductHandleTable handles;
+    // Built by the first name query after a load, then kept up to date
+    mutable ProductNameIndex nameIndex;
+    mutable bool nameIndexBuilt = false;
+    // Price, quantity and expiry indexes, likewise built by the first range
+    // query and then kept up to date. ConcurrentInventory changes products
+    // under shared locks, so it drops them instead.
+    mutable OrderedSlotIndex<Cents> priceIndex;
+    mutable OrderedSlotIndex<int> quantityIndex;
+    mutable OrderedSlotIndex<int32_t> expiryIndex;
+    // Food and medicine still in stock, soonest expiry on top
+    mutable ExpiryHeap expiryHeap;
+    mutable atomic<bool> rangeIndexesBuilt{false};
+    // Running report totals, built by the first report and kept up to date
+    // through the same slot hooks as the range indexes
+    mutable StockTotals stockTotals;
+    mutable atomic<bool> stockTotalsBuilt{false};
+    const vector<string> categoryFiles = {
+        "electronics_inventory.csv",
+        "food_inventory.csv", 
+        "medicine_inventory.csv"
+    };
+    const vector<CategoryId> fileCategories = {
+        CategoryRegistry::ELECTRONICS,
+        CategoryRegistry::FOOD,
+        CategoryRegistry::MEDICINE
+    };
+
+public:
+    // Products below this quantity are flagged in stock reports
+    static constexpr int LOW_STOCK_THRESHOLD = 10;
+
+    // How saveToFiles persists changes. Either way every change is first
+    // written to the change log (the write-ahead log) before it is reported.
+    enum class SaveMode {
+        Rewrite,    // Rewrite the CSV file of every changed category, then clear the log
+        ChangeLog   // Leave changes in the log, compacted into the CSVs in the background
+    };
+
+private:
+    // Changes not yet folded into the CSV files. A compaction moves the live
+    // log aside while it rewrites the CSVs, so a load replays both.
+    static constexpr const char* CHANGE_LOG_FILE = "inventory_changes.log";
+    static constexpr const char* COMPACTING_LOG_FILE = "inventory_changes.log.compacting";
+    static constexpr size_t MIN_COMPACT_RECORDS = 10000;
+
+    SaveMode saveMode = SaveMode::Rewrite;
+    bitset<CategoryRegistry::MAX_CATEGORIES> dirtyCategories;
+    SyncedAppendFile changeLog{CHANGE_LOG_FILE};
+    size_t logRecords = 0;       // Records in the change log files
+
+    // Group commit: records are appended to pendingRecords under logMutex and
+    // one thread at a time writes and syncs everything pending, so writers on
+    // other threads share its sync instead of queueing for their own
+    mutex logMutex;
+    condition_variable logSynced;
+    string pendingRecords;
+    string syncingRecords;
+    uint64_t appendedRecords = 0;   // Records ever appended and ever synced
+    uint64_t syncedRecords = 0;
+    uint64_t writtenRecords = 0;    // Records synced before any failed write
+    bool logFailed = false;         // A write failed; nothing is written until a save
+    bool logSyncing = false;
+    bool syncDeferred = false;      // Records wait for syncPendingChanges()
+    thread compactor;
+    bitset<CategoryRegistry::MAX_CATEGORIES> compactingCategories;
+    atomic<bool> compactionFailed{false};
+
+    // Binary copy of what the CSV files hold, loaded instead of them on
+    // startup while it still matches them
+    static constexpr const char* SNAPSHOT_FILE = "inventory.snapshot";
+    static constexpr size_t MAX_SHARED_SNAPSHOT_STRINGS = 1 << 16;
+    static constexpr size_t MIN_SNAPSHOT_PIECE = 1 << 16;
+    bool snapshotEnabled = true;
+    bool snapshotCurrent = false;   // The snapshot file matches the CSV files
+
+    // Parallel loads never split files into pieces smaller than this
+    static constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+
+    // Load problems and I/O errors for the frontend to show; the manager
+    // itself never prints
+    mutex messageMutex;
+    vector<string> messages;
+
+    // One newline-aligned slice of a category file, parsed by a load worker
+    struct CsvChunk {
+        size_t file = 0;
+        size_t begin = 0;          // Byte range [begin, end) of the file
+        size_t end = 0;
+        size_t firstRecord = 0;    // Where parsing really started and stopped;
+        size_t stopRecord = 0;     // they must meet between neighbouring chunks
+        size_t newlines = 0;       // Line breaks in [begin, end), for line numbers
+        unique_ptr<ProductArena> arena;
+        vector<ProductPtr> products;
+        vector<size_t> productLines;
+        vector<pair<size_t, string>> rejects;
+    };
+
+    void note(string message) {
+        lock_guard<mutex> lock(messageMutex);
+        messages.push_back(move(message));
+    }
+
+    bool hasProductsIn(CategoryId category) const {
+        return any_of(inventory.begin(), inventory.end(),
+            [category](const ProductPtr& p) { return p->getCategoryId() == category; });
+    }
+
+    struct AcceptAll {
+        bool operator()(const Product&) const { return true; }
+    };
+
+    // Format one category as CSV, with the header of its first product,
+    // keeping the rows keep() accepts. The inventory is cut into slices that
+    // one set of workers claims in order and formats into a ring of buffers,
+    // while another thread hands each finished buffer to write in inventory
+    // order. A worker waits while its slice is a whole ring ahead of the
+    // writer, so memory stays bounded and no product list is built.
+    // threads == 0 uses every core.
+    template <typename Write, typename Keep = AcceptAll>
+    void formatCategoryCsv(CategoryId category, Write&& write, const Keep& keep = Keep(),
+                           unsigned threads = 0) const {
+        static constexpr size_t SLICE_PRODUCTS = 16384;
+        static constexpr size_t NO_SLICE = SIZE_MAX;
+        auto first = find_if(inventory.begin(), inventory.end(),
+            [category](const ProductPtr& p) { return p->getCategoryId() == category; });
+        if (first == inventory.end()) return;
+        string header((*first)->getCsvHeader());
+        header += '\n';
+        write(string_view(header));
+
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        size_t begin = first - inventory.begin();
+        size_t slices = (inventory.size() - begin + SLICE_PRODUCTS - 1) / SLICE_PRODUCTS;
+        auto formatSlice = [&](size_t slice, string& buffer) {
+            buffer.clear();
+            size_t from = begin + slice * SLICE_PRODUCTS;
+            size_t to = min(inventory.size(), from + SLICE_PRODUCTS);
+            for (size_t slot = from; slot < to; slot++) {
+                const Product& product = *inventory[slot];
+                if (product.getCategoryId() != category || !keep(product)) continue;
+                product.toCsvRow(buffer);
+                buffer += '\n';
+            }
+        };
+
+        size_t formatters = min<size_t>(threads, slices);
+        if (formatters <= 1) {
+            string buffer;
+            for (size_t slice = 0; slice < slices; slice++) {
+                formatSlice(slice, buffer);
+                write(string_view(buffer));
+            }
+            return;
+        }
+
+        size_t ring = formatters * 2;
+        vector<string> buffers(ring);
+        vector<size_t> bufferSlice(ring, NO_SLICE); // The finished slice each buffer holds
+        mutex ringMutex;
+        condition_variable ringChanged;
+        size_t written = 0;
+        atomic<size_t> nextSlice{0};
+        // Task formatters is the writer; every task gets its own thread
+        runParallel(formatters + 1, unsigned(formatters + 1), [&](size_t task) {
+            if (task == formatters) {
+                for (size_t slice = 0; slice < slices; slice++) {
+                    size_t index = slice % ring;
+                    {
+                        unique_lock<mutex> lock(ringMutex);
+                        ringChanged.wait(lock, [&] { return bufferSlice[index] == slice; });
+                    }
+                    write(string_view(buffers[index]));
+                    lock_guard<mutex> lock(ringMutex);
+                    bufferSlice[index] = NO_SLICE;
+                    written = slice + 1;
+                    ringChanged.notify_all();
+                }
+                return;
+            }
+            for (size_t slice = nextSlice.fetch_add(1); slice < slices; slice = nextSlice.fetch_add(1)) {
+                size_t index = slice % ring;
+                {
+                    unique_lock<mutex> lock(ringMutex);
+                    ringChanged.wait(lock, [&] { return slice < written + ring; });
+                }
+                formatSlice(slice, buffers[index]);
+                lock_guard<mutex> lock(ringMutex);
+                bufferSlice[index] = slice;
+                ringChanged.notify_all();
+            }
+        });
+    }
+
+    // Save products of a specific category to their respective CSV file,
+    // replacing it atomically
+    bool saveCategoryToFile(CategoryId category, const string& filename) {
+        if (!hasProductsIn(category) && !ifstream(filename).is_open()) {
+            return true; // Don't create empty files
+        }
+
+        AtomicFileWriter file;
+        if (!file.open(filename)) {
+            note("Error: Could not open " + filename + " for writing!");
+            return false;
+        }
+        formatCategoryCsv(category, [&file](string_view block) { file.write(block); });
+        if (!file.commit()) {
+            note("Error: Could not write " + filename + "!");
+            return false;
+        }
+        return true;
+    }
+
+    // A product was added or changed: its category file is dirty and its new
+    // state is in the change log before the change is reported. False if it
+    // could not be logged; the change then waits for the next save.
+    bool markChanged(const Product& product) {
+        bool logged = logPut(product);
+        compactIfDue();
+        return logged;
+    }
+
+    // A product is about to be removed
+    bool markRemoved(const Product& product) {
+        bool logged = logDel(product);
+        compactIfDue();
+        return logged;
+    }
+
+    // Only the product's stock changed
+    bool markStockChanged(const Product& product) {
+        bool logged = logStock(product);
+        compactIfDue();
+        return logged;
+    }
+
+    // Thread-safe halves of the above; the caller keeps the product from
+    // changing until they return
+    bool logStock(const Product& product) {
+        unique_lock<mutex> lock(logMutex);
+        dirtyCategories.set(product.getCategoryId());
+        appendStockRecord(pendingRecords, product);
+        return syncChangeLog(lock);
+    }
+
+    bool logPut(const Product& product) {
+        unique_lock<mutex> lock(logMutex);
+        dirtyCategories.set(product.getCategoryId());
+        appendPutRecord(pendingRecords, product);
+        return syncChangeLog(lock);
+    }
+
+    bool logDel(const Product& product) {
+        unique_lock<mutex> lock(logMutex);
+        dirtyCategories.set(product.getCategoryId());
+        appendDelRecord(pendingRecords, product.getProductId());
+        return syncChangeLog(lock);
+    }
+
+    // Groups ahead of the current one whose product applyBatch prefetches
+    static constexpr size_t PREFETCH_DISTANCE = 8;
+
+    // applyBatch sort key: where an operation's ID hash falls in ID-index
+    // order (ProductIdIndex::probeOrder), and the operation
+    struct BatchKey {
+        size_t order;
+        size_t op;
+    };
+
+    // The operations of a batch on one ID and what the dry run made of them
+    struct BatchGroup {
+        size_t begin = 0;              // Range [begin, end) of the sorted keys
+        size_t end = 0;
+        size_t hash = 0;
+        size_t slot = 0;               // Inventory slot before the batch, or npos
+        int quantity = 0;              // Final stock
+        const Cents* price = nullptr;  // Final price, if any operation set one
+        bool reshapes = false;         // Adds or removes the product
+    };
+
+    // Sort keys by order, keeping batch order among equal keys. A stable LSD
+    // radix sort on the upper half of the order (8 bits per pass) leaves
+    // only keys that share it to be put in full order; with hashed orders
+    // those runs hold nearly always a single ID.
+    static void sortBatchKeys(vector<BatchKey>& keys) {
+        static constexpr unsigned DIGIT_BITS = 8;
+        static constexpr size_t BUCKETS = size_t(1) << DIGIT_BITS;
+        static constexpr unsigned ORDER_BITS = sizeof(size_t) * CHAR_BIT;
+        vector<BatchKey> scratch(keys.size());
+        for (unsigned shift = ORDER_BITS / 2; shift < ORDER_BITS; shift += DIGIT_BITS) {
+            size_t counts[BUCKETS] = {};
+            for (const BatchKey& key : keys) counts[(key.order >> shift) & (BUCKETS - 1)]++;
+            size_t offset = 0;
+            for (size_t& count : counts) {
+                size_t bucket = count;
+                count = offset;
+                offset += bucket;
+            }
+            for (const BatchKey& key : keys) scratch[counts[(key.order >> shift) & (BUCKETS - 1)]++] = key;
+            keys.swap(scratch);
+        }
+
+        auto upperHalf = [](size_t order) { return order >> (ORDER_BITS / 2); };
+        for (size_t begin = 0, end; begin < keys.size(); begin = end) {
+            bool sorted = true;
+            for (end = begin + 1; end < keys.size() && upperHalf(keys[end].order) == upperHalf(keys[begin].order); end++) {
+                sorted &= keys[end].order >= keys[end - 1].order;
+            }
+            if (!sorted) {
+                stable_sort(keys.begin() + begin, keys.begin() + end,
+                            [](const BatchKey& a, const BatchKey& b) { return a.order < b.order; });
+            }
+        }
+    }
+
+    // Split sorted keys into per-ID groups and look each ID up once; the keys
+    // are in table order, so this walks the ID index front to back. Equal
+    // keys almost always mean equal IDs; byId also compares the IDs, for
+    // batches where two IDs' hashes collide.
+    vector<BatchGroup> groupBatchKeys(vector<BatchKey>& keys, const vector<BatchOperation>& operations,
+                                      bool byId) const {
+        auto idOf = [&](size_t k) { return operations[keys[k].op].id(); };
+        if (byId) {
+            for (size_t begin = 0, end; begin < keys.size(); begin = end) {
+                for (end = begin + 1; end < keys.size() && keys[end].order == keys[begin].order; end++) {}
+                stable_sort(keys.begin() + begin, keys.begin() + end, [&operations](const BatchKey& a, const BatchKey& b) {
+                    return operations[a.op].id() < operations[b.op].id();
+                });
+            }
+        }
+        vector<BatchGroup> groups;
+        for (size_t k = 0; k < keys.size();) {
+            BatchGroup group;
+            group.begin = k;
+            for (k++; k < keys.size() && keys[k].order == keys[group.begin].order; k++) {
+                if (byId && idOf(k) != idOf(group.begin)) break;
+            }
+            group.end = k;
+            group.hash = idIndex.hashOfOrder(keys[group.begin].order);
+            group.slot = idIndex.find(idOf(group.begin), group.hash);
+            groups.push_back(group);
+        }
+        return groups;
+    }
+
+    // Check every operation of a grouped batch against the current inventory,
+    // tracking per ID whether the product exists and its stock, and fill in
+    // the statuses and each group's final values. Returns false, leaving the
+    // statuses incomplete, if a group turns out to hold two IDs.
+    bool dryRunBatch(const vector<BatchKey>& keys, vector<BatchGroup>& groups,
+                     const vector<BatchOperation>& operations, BatchResult& result, size_t& adds) const {
+        adds = 0;
+        for (size_t g = 0; g < groups.size(); g++) {
+#if defined(__GNUC__) || defined(__clang__)
+            if (g + PREFETCH_DISTANCE < groups.size() && groups[g + PREFETCH_DISTANCE].slot != ProductIdIndex::npos) {
+                __builtin_prefetch(inventory[groups[g + PREFETCH_DISTANCE].slot].get());
+            }
+#endif
+            BatchGroup& group = groups[g];
+            string_view id = operations[keys[group.begin].op].id();
+            bool exists = group.slot != ProductIdIndex::npos;
+            long long quantity = exists ? inventory[group.slot]->getQuantity() : 0;
+            for (size_t k = group.begin; k < group.end; k++) {
+                const BatchOperation& op = operations[keys[k].op];
+                if (op.id() != id) return false;
+                OpStatus& status = result.statuses[keys[k].op];
+                status = OpStatus::Ok;
+                switch (op.kind) {
+                    case BatchOperation::Kind::Add:
+                        group.reshapes = true;
+                        if (!op.product) status = OpStatus::InvalidProduct;
+                        else if (!isValidPrice(op.product->getPrice())) status = OpStatus::InvalidPrice;
+                        else if (exists) status = OpStatus::DuplicateId;
+                        else {
+                            exists = true;
+                            quantity = op.product->getQuantity();
+                            adds++;
+                        }
+                        break;
+                    case BatchOperation::Kind::AdjustStock:
+                        if (!exists) status = OpStatus::NotFound;
+                        else if (quantity + op.quantityChange > INT_MAX || quantity + op.quantityChange < INT_MIN) {
+                            status = OpStatus::StockOverflow;
+                        } else {
+                            quantity += op.quantityChange;
+                        }
+                        break;
+                    case BatchOperation::Kind::SetPrice:
+                        if (!exists) status = OpStatus::NotFound;
+                        else if (!isValidPrice(op.price)) status = OpStatus::InvalidPrice;
+                        else group.price = &op.price;
+                        break;
+                    case BatchOperation::Kind::Remove:
+                        group.reshapes = true;
+                        if (!exists) status = OpStatus::NotFound;
+                        else exists = false;
+                        break;
+                }
+            }
+            group.quantity = static_cast<int>(quantity);
+        }
+        return true;
+    }
+
+    // Log count records as one unit: a "batch,<count>" record ahead of them
+    // lets a replay drop a batch that a crash cut short
+    bool logBatch(const string& records, size_t count, const bitset<CategoryRegistry::MAX_CATEGORIES>& touched) {
+        if (count == 0) return true;
+        unique_lock<mutex> lock(logMutex);
+        dirtyCategories |= touched;
+        if (count > 1) {
+            pendingRecords += "batch,";
+            pendingRecords += to_string(count);
+            pendingRecords += '\n';
+        }
+        pendingRecords += records;
+        return syncChangeLog(lock, count);
+    }
+
+    // Wait until the record just appended to pendingRecords is synced, writing
+    // the pending batch ourselves if no other thread is; false if it could
+    // not be written. While syncs are deferred the record just stays pending,
+    // unless a write already failed: then it is known not to be logged.
+    bool syncChangeLog(unique_lock<mutex>& lock, size_t records = 1) {
+        appendedRecords += records;
+        if (syncDeferred && !logFailed) return true;
+        return waitForSync(lock, appendedRecords);
+    }
+
+    // True once the records up to position are on disk; false if they could
+    // not be written. After a failed write nothing more is written until a
+    // save has put every change in the CSV files, so a replay never applies
+    // a change without the ones before it.
+    bool waitForSync(unique_lock<mutex>& lock, uint64_t position) {
+        while (syncedRecords < position) {
+            if (logSyncing) {
+                logSynced.wait(lock);
+                continue;
+            }
+            logSyncing = true;
+            uint64_t batchEnd = appendedRecords;
+            bool failedBefore = logFailed;
+            swap(pendingRecords, syncingRecords);
+            lock.unlock();
+            bool written = !failedBefore && changeLog.append(syncingRecords);
+            syncingRecords.clear();
+            lock.lock();
+            if (written) {
+                logRecords += batchEnd - syncedRecords;
+                writtenRecords = batchEnd;
+            } else if (!failedBefore) {
+                logFailed = true;
+                note(string("Error: Could not write ") + CHANGE_LOG_FILE +
+                     "; changes from now on are only kept by saving.");
+            }
+            syncedRecords = batchEnd;
+            logSyncing = false;
+            logSynced.notify_all();
+        }
+        return writtenRecords >= position;
+    }
+
+    // Every change is in the CSV files: the log may be written again
+    void clearLogFailure() {
+        lock_guard<mutex> lock(logMutex);
+        logFailed = false;
+        writtenRecords = syncedRecords;
+    }
+
+    bool hasLogFailure() {
+        lock_guard<mutex> lock(logMutex);
+        return logFailed;
+    }
+
+    void compactIfDue() {
+        if (saveMode == SaveMode::ChangeLog && logRecords >= max(MIN_COMPACT_RECORDS, inventory.size() / 4)) {
+            startCompaction();
+        }
+    }
+
+    // Row layout (the built-in category) for a product type name
+    static bool layoutForType(string_view type, CategoryId& layout) {
+        if (type == "Electronic") layout = CategoryRegistry::ELECTRONICS;
+        else if (type == "Food") layout = CategoryRegistry::FOOD;
+        else if (type == "Medicine") layout = CategoryRegistry::MEDICINE;
+        else return false;
+        return true;
+    }
+
+    // Change log records are CSV lines holding a product's whole state, or
+    // its new quantity, so replaying a record twice gives the same result:
+    //   put,<type>,<category>,<CSV row of the type's file>
+    //   qty,<product id>,<quantity>
+    //   del,<product id>
+    static void appendPutRecord(string& out, const Product& product) {
+        out += "put,";
+        out += product.getProductType();
+        out += ',';
+        Product::appendCsvField(out, product.getCategory());
+        out += ',';
+        product.toCsvRow(out);
+        out += '\n';
+    }
+
+    static void appendStockRecord(string& out, const Product& product) {
+        out += "qty,";
+        Product::appendCsvField(out, product.getProductId());
+        out += ',';
+        Product::appendCsvNumber(out, product.getQuantity());
+        out += '\n';
+    }
+
+    static void appendDelRecord(string& out, string_view id) {
+        out += "del,";
+        Product::appendCsvField(out, id);
+        out += '\n';
+    }
+
+    // Fold the change log back into the CSV files. Dirty categories are
+    // formatted here, then a background thread writes them out while the
+    // log is moved aside; the moved log is deleted once every file is
+    // written, and until then a load simply replays it again.
+    void startCompaction() {
+        waitForCompaction();
+        vector<pair<string, string>> files;
+        for (size_t f = 0; f < categoryFiles.size(); f++) {
+            CategoryId category = fileCategories[f];
+            if (!dirtyCategories.test(category)) continue;
+            if (!hasProductsIn(category) && !ifstream(categoryFiles[f]).is_open()) continue;
+            string contents;
+            formatCategoryCsv(category, [&contents](string_view block) { contents += block; });
+            files.emplace_back(categoryFiles[f], move(contents));
+        }
+        // The snapshot is finished once the new CSV files' stamps are known
+        string snapshot;
+        if (snapshotEnabled && !formatSnapshot({}, [&snapshot](string_view block) { snapshot += block; })) {
+            snapshot.clear();
+        }
+        snapshotCurrent = !snapshot.empty();
+        compactingCategories = dirtyCategories;
+        dirtyCategories.reset();
+        changeLog.close();
+        remove(COMPACTING_LOG_FILE);
+        rename(CHANGE_LOG_FILE, COMPACTING_LOG_FILE);
+        logRecords = 0;
+
+        compactor = thread([this, files = move(files), snapshot = move(snapshot)]() mutable {
+            bool written = true;
+            for (const auto& file : files) {
+                AtomicFileWriter out;
+                written = out.open(file.first) && written;
+                out.write(file.second);
+                written = out.commit() && written;
+            }
+            if (written && !snapshot.empty()) {
+                SnapshotHeader header;
+                memcpy(&header, snapshot.data(), sizeof(header));
+                for (size_t f = 0; f < categoryFiles.size(); f++) header.files[f] = fileStamp(categoryFiles[f]);
+                memcpy(&snapshot[0], &header, sizeof(header));
+                SnapshotChecksum checksum;
+                checksum.update(snapshot);
+                written = writeSnapshotFile(snapshot, checksum.finish());
+            }
+            if (written) remove(COMPACTING_LOG_FILE);
+            compactionFailed.store(!written);
+        });
+    }
+
+    // Write the snapshot of the products in the CSV files, in file order,
+    // without its trailer. Returns false if the strings exceed the format's
+    // 4 GiB heap.
+    template <typename Write>
+    bool formatSnapshot(const array<SnapshotFileStamp, 3>& stamps, Write&& write) const {
+        vector<const Product*> products;
+        for (CategoryId category : fileCategories) {
+            for (const auto& product : inventory) {
+                if (product->getCategoryId() == category) products.push_back(product.get());
+            }
+        }
+        size_t count = products.size();
+
+        auto put = [&write](const void* data, size_t bytes) {
+            static const char padding[8] = {};
+            write(string_view(static_cast<const char*>(data), bytes));
+            write(string_view(padding, SnapshotLayout::align8(bytes) - bytes));
+        };
+        // Low-cardinality text (brands, dates) is stored once; IDs and names
+        // are appended as they come
+        string heap;
+        unordered_map<string_view, uint32_t> shared;
+        bool overflow = false;
+        auto addString = [&](string_view text, bool dedupe) {
+            if (dedupe) {
+                auto it = shared.find(text);
+                if (it != shared.end()) return SnapshotStringRef{it->second, uint32_t(text.size())};
+            }
+            if (heap.size() + text.size() > UINT32_MAX) {
+                overflow = true;
+                return SnapshotStringRef{0, 0};
+            }
+            SnapshotStringRef ref{uint32_t(heap.size()), uint32_t(text.size())};
+            heap += text;
+            if (dedupe && shared.size() < MAX_SHARED_SNAPSHOT_STRINGS) shared.emplace(text, ref.offset);
+            return ref;
+        };
+
+        SnapshotHeader header;
+        memcpy(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic));
+        header.version = SnapshotHeader::VERSION;
+        header.categoryCount = uint32_t(fileCategories.size());
+        header.productCount = count;
+        for (size_t f = 0; f < stamps.size(); f++) header.files[f] = stamps[f];
+        put(&header, sizeof(header));
+
+        vector<SnapshotStringRef> refs;
+        for (CategoryId category : fileCategories) refs.push_back(addString(CategoryRegistry::name(category), true));
+        put(refs.data(), refs.size() * sizeof(SnapshotStringRef));
+
+        vector<uint8_t> bytes(count);
+        vector<CategoryId> layouts(count);
+        for (size_t i = 0; i < count; i++) layoutForType(products[i]->getProductType(), layouts[i]);
+        put(layouts.data(), count);
+        for (size_t i = 0; i < count; i++) {
+            bytes[i] = uint8_t(find(fileCategories.begin(), fileCategories.end(), products[i]->getCategoryId())
+                               - fileCategories.begin());
+        }
+        put(bytes.data(), count);
+        for (size_t i = 0; i < count; i++) {
+            switch (layouts[i]) {
+                case CategoryRegistry::FOOD:
+                    bytes[i] = static_cast<const Food*>(products[i])->getIsOrganic();
+                    break;
+                case CategoryRegistry::MEDICINE:
+                    bytes[i] = static_cast<const Medicine*>(products[i])->getPrescriptionRequired();
+                    break;
+                default:
+                    bytes[i] = 0;
+            }
+        }
+        put(bytes.data(), count);
+
+        vector<Cents> prices(count);
+        for (size_t i = 0; i < count; i++) prices[i] = products[i]->getPrice();
+        put(prices.data(), count * sizeof(Cents));
+        vector<int32_t> ints(count);
+        for (size_t i = 0; i < count; i++) ints[i] = products[i]->getQuantity();
+        put(ints.data(), count * sizeof(int32_t));
+        for (size_t i = 0; i < count; i++) {
+            ints[i] = (layouts[i] == CategoryRegistry::ELECTRONICS)
+                ? static_cast<const Electronic*>(products[i])->getWarrantyMonths() : 0;
+        }
+        put(ints.data(), count * sizeof(int32_t));
+
+        refs.resize(count);
+        for (size_t i = 0; i < count; i++) refs[i] = addString(products[i]->getProductId(), false);
+        put(refs.data(), count * sizeof(SnapshotStringRef));
+        for (size_t i = 0; i < count; i++) refs[i] = addString(products[i]->getName(), false);
+        put(refs.data(), count * sizeof(SnapshotStringRef));
+        for (size_t i = 0; i < count; i++) {
+            string_view text;
+            switch (layouts[i]) {
+                case CategoryRegistry::ELECTRONICS: text = static_cast<const Electronic*>(products[i])->getBrand(); break;
+                case CategoryRegistry::FOOD: text = static_cast<const Food*>(products[i])->getExpiryDate(); break;
+                case CategoryRegistry::MEDICINE: text = static_cast<const Medicine*>(products[i])->getManufacturer(); break;
+            }
+            refs[i] = addString(text, true);
+        }
+        put(refs.data(), count * sizeof(SnapshotStringRef));
+        for (size_t i = 0; i < count; i++) {
+            refs[i] = (layouts[i] == CategoryRegistry::MEDICINE)
+                ? addString(static_cast<const Medicine*>(products[i])->getExpiryDate(), true) : SnapshotStringRef{0, 0};
+        }
+        put(refs.data(), count * sizeof(SnapshotStringRef));
+
+        put(heap.data(), heap.size());
+        SnapshotTrailer trailer{heap.size(), 0};
+        write(string_view(reinterpret_cast<const char*>(&trailer), sizeof(trailer.heapBytes)));
+        return !overflow;
+    }
+
+    // Atomically replace the snapshot file with formatted snapshot contents
+    // (everything but the checksum)
+    static bool writeSnapshotFile(string_view contents, uint64_t checksum) {
+        AtomicFileWriter out;
+        if (!out.open(SNAPSHOT_FILE)) return false;
+        out.write(contents);
+        out.write(string_view(reinterpret_cast<const char*>(&checksum), sizeof(checksum)));
+        return out.commit();
+    }
+
+    array<SnapshotFileStamp, 3> currentFileStamps() const {
+        array<SnapshotFileStamp, 3> stamps;
+        for (size_t f = 0; f < categoryFiles.size(); f++) stamps[f] = fileStamp(categoryFiles[f]);
+        return stamps;
+    }
+
+    // Snapshot the inventory after the CSV files were written
+    bool writeSnapshot() const {
+        AtomicFileWriter out;
+        if (!out.open(SNAPSHOT_FILE)) return false;
+        SnapshotChecksum checksum;
+        bool formatted = formatSnapshot(currentFileStamps(), [&](string_view block) {
+            checksum.update(block);
+            out.write(block);
+        });
+        if (!formatted) return false;
+        uint64_t sum = checksum.finish();
+        out.write(string_view(reinterpret_cast<const char*>(&sum), sizeof(sum)));
+        return out.commit();
+    }
+
+    // Join the background compaction; if it could not write every file, its
+    // categories are dirty again so the next save or compaction retries them
+    void waitForCompaction() {
+        if (!compactor.joinable()) return;
+        compactor.join();
+        if (compactionFailed.exchange(false)) {
+            note(string("Error: Could not compact ") + COMPACTING_LOG_FILE + " into the CSV files!");
+            dirtyCategories |= compactingCategories;
+            snapshotCurrent = false;
+        }
+    }
+
+    // Put product in slot in place of the product there now
+    void replaceSlot(size_t slot, ProductPtr& product) {
+        idIndex.erase(inventory[slot]->getProductId());
+        idIndex.insert(product->getProductId(), slot);
+        if (nameIndexBuilt) nameIndex.rename(slot, product->getName());
+        unindexSlot(slot);
+        inventory[slot] = move(product);
+        indexSlot(slot);
+    }
+
+    // A parsed change log record: a put carries the product, a qty the new
+    // quantity and a del only the ID
+    struct ChangeRecord {
+        string id;
+        ProductPtr product;
+        int quantity = 0;
+        bool stockOnly = false;
+    };
+
+    void applyChangeRecord(ChangeRecord& record) {
+        if (!record.product) {
+            size_t slot = idIndex.find(record.id);
+            if (slot == ProductIdIndex::npos) return;
+            dirtyCategories.set(inventory[slot]->getCategoryId());
+            if (record.stockOnly) {
+                SlotKeys before = slotKeys(slot);
+                inventory[slot]->setQuantity(record.quantity);
+                reindexSlot(slot, before);
+            } else {
+                eraseSlot(slot);
+            }
+            return;
+        }
+        dirtyCategories.set(record.product->getCategoryId());
+        size_t slot = idIndex.find(record.product->getProductId());
+        if (slot == ProductIdIndex::npos) {
+            insertProduct(record.product);
+        } else {
+            dirtyCategories.set(inventory[slot]->getCategoryId());
+            replaceSlot(slot, record.product);
+        }
+    }
+
+    // Apply a change log on top of the loaded CSV files. Categories it
+    // touches become dirty, so a rewrite save folds the log back in. The
+    // records after a "batch,<count>" record are held back until all count
+    // have been read, so a batch cut short by a crash is dropped whole.
+    CsvLoadReport replayChangeLog(const string& filename) {
+        CsvLoadReport report;
+        report.filename = filename;
+
+        MappedFile file;
+        if (!file.open(filename)) {
+            return report;
+        }
+        loadArenas.push_back(make_unique<ProductArena>(file.contents().size()));
+        ProductArena& arena = *loadArenas.back();
+        CsvReader reader(file.contents());
+        vector<string_view> row;
+        string error;
+        ChangeRecord record;
+        vector<ChangeRecord> batch;
+        size_t batchRemaining = 0;
+        size_t batchLine = 0;
+        while (reader.nextRecord()) {
+            const vector<string_view>& fields = reader.getFields();
+            if (reader.hasUnterminatedQuote()) {
+                report.reject(reader.getLineNumber(), "unterminated quoted field");
+                continue;
+            }
+            if (fields.size() == 2 && fields[0] == "batch") {
+                if (batchRemaining > 0) report.reject(batchLine, "incomplete batch");
+                batch.clear();
+                batchRemaining = 0;
+                batchLine = reader.getLineNumber();
+                if (!parseNumberField(fields[1], batchRemaining)) {
+                    report.reject(batchLine, "invalid batch size");
+                }
+                continue;
+            }
+
+            record.product.reset();
+            record.stockOnly = false;
+            if (fields.size() == 2 && fields[0] == "del") {
+                record.id = fields[1];
+            } else if (fields.size() == 3 && fields[0] == "qty") {
+                record.id = fields[1];
+                record.stockOnly = true;
+                if (!parseNumberField(fields[2], record.quantity)) {
+                    report.reject(reader.getLineNumber(), "invalid quantity '" + string(fields[2]) + "'");
+                    continue;
+                }
+            } else {
+                CategoryId layout;
+                if (fields.size() < 4 || fields[0] != "put" || !layoutForType(fields[1], layout)) {
+                    report.reject(reader.getLineNumber(), "unknown change record");
+                    continue;
+                }
+                row.assign(fields.begin() + 3, fields.end());
+                record.product = productFromCsvFields(row, layout, arena, error);
+                if (!record.product) {
+                    report.reject(reader.getLineNumber(), error);
+                    continue;
+                }
+                record.product->setCategory(fields[2]);
+            }
+
+            if (batchRemaining == 0) {
+                applyChangeRecord(record);
+                report.rowsLoaded++;
+                continue;
+            }
+            batch.push_back(move(record));
+            if (--batchRemaining == 0) {
+                for (ChangeRecord& held : batch) applyChangeRecord(held);
+                report.rowsLoaded += batch.size();
+                batch.clear();
+            }
+        }
+        if (batchRemaining > 0) report.reject(batchLine, "incomplete batch");
+        logRecords += report.rowsLoaded + report.rowsRejected;
+        return report;
+    }
+
+    // Forget pending changes before a load replaces the inventory
+    void resetChangeTracking() {
+        syncPendingChanges();
+        waitForCompaction();
+        dirtyCategories.reset();
+        changeLog.close();
+        clearLogFailure();
+        logRecords = 0;
+        snapshotCurrent = false;
+    }
+
+    void replayChangeLogs() {
+        noteLoadProblems(replayChangeLog(COMPACTING_LOG_FILE));
+        noteLoadProblems(replayChangeLog(CHANGE_LOG_FILE));
+    }
+
+    // searchById without counting a lookup, for the engine's own use
+    Product* findProduct(string_view id) const {
+        size_t slot = idIndex.find(id);
+        return (slot != ProductIdIndex::npos) ? inventory[slot].get() : nullptr;
+    }
+
+    // Append a product and index it; returns false if the ID is already taken
+    // Takes ownership only on success, so callers can still report the product
+    bool insertProduct(ProductPtr& product) {
+        return insertProduct(product, ProductIdIndex::hashOf(product->getProductId()));
+    }
+
+    bool insertProduct(ProductPtr& product, size_t idHash) {
+        if (!idIndex.insert(product->getProductId(), inventory.size(), idHash)) {
+            return false;
+        }
+        if (nameIndexBuilt) nameIndex.add(product->getName());
+        inventory.push_back(move(product));
+        handles.append();
+        indexSlot(inventory.size() - 1);
+        return true;
+    }
+
+    const ProductNameIndex& builtNameIndex() const {
+        if (!nameIndexBuilt) {
+            nameIndex.clear();
+            nameIndex.reserve(inventory.size());
+            for (const auto& product : inventory) nameIndex.add(product->getName());
+            nameIndexBuilt = true;
+        }
+        return nameIndex;
+    }
+
+    void buildRangeIndexes() const {
+        if (rangeIndexesBuilt.load(memory_order_relaxed)) return;
+        priceIndex.clear();
+        quantityIndex.clear();
+        expiryIndex.clear();
+        expiryHeap.clear();
+        for (size_t slot = 0; slot < inventory.size(); slot++) {
+            const Product& product = *inventory[slot];
+            priceIndex.append(product.getPrice(), slot);
+            quantityIndex.append(product.getQuantity(), slot);
+            if (product.getExpiryDays() != NO_EXPIRY) expiryIndex.append(product.getExpiryDays(), slot);
+            if (product.getExpiryDays() != NO_EXPIRY && product.getQuantity() > 0) {
+                expiryHeap.append(product.getExpiryDays(), slot);
+            }
+        }
+        priceIndex.sortAppended();
+        quantityIndex.sortAppended();
+        expiryIndex.sortAppended();
+        expiryHeap.heapify();
+        rangeIndexesBuilt = true;
+    }
+
+    void buildStockTotals() const {
+        if (stockTotalsBuilt.load(memory_order_relaxed)) return;
+        stockTotals.clear();
+        for (size_t slot = 0; slot < inventory.size(); slot++) {
+            const Product& product = *inventory[slot];
+            stockTotals.add(slot, product.getCategoryId(), product.getPrice(), product.getQuantity(),
+                            LOW_STOCK_THRESHOLD);
+        }
+        stockTotalsBuilt = true;
+    }
+
+    // Take a slot's product out of the range indexes and stock totals before
+    // its price, quantity, expiry or category changes or it leaves the slot,
+    // and put it back after
+    void unindexSlot(size_t slot) {
+        const Product& product = *inventory[slot];
+        if (stockTotalsBuilt.load(memory_order_relaxed)) {
+            stockTotals.remove(slot, product.getCategoryId(), product.getPrice(), product.getQuantity(),
+                               LOW_STOCK_THRESHOLD);
+        }
+        if (!rangeIndexesBuilt.load(memory_order_relaxed)) return;
+        priceIndex.erase(product.getPrice(), slot);
+        quantityIndex.erase(product.getQuantity(), slot);
+        if (product.getExpiryDays() != NO_EXPIRY) expiryIndex.erase(product.getExpiryDays(), slot);
+        expiryHeap.erase(slot);
+    }
+
+    void indexSlot(size_t slot) {
+        const Product& product = *inventory[slot];
+        if (stockTotalsBuilt.load(memory_order_relaxed)) {
+            stockTotals.add(slot, product.getCategoryId(), product.getPrice(), product.getQuantity(),
+                            LOW_STOCK_THRESHOLD);
+        }
+        if (!rangeIndexesBuilt.load(memory_order_relaxed)) return;
+        priceIndex.insert(product.getPrice(), slot);
+        quantityIndex.insert(product.getQuantity(), slot);
+        if (product.getExpiryDays() != NO_EXPIRY) expiryIndex.insert(product.getExpiryDays(), slot);
+        if (product.getExpiryDays() != NO_EXPIRY && product.getQuantity() > 0) {
+            expiryHeap.insert(product.getExpiryDays(), slot);
+        }
+    }
+
+    // A product's keys in the range indexes and stock totals, taken before
+    // an edit of its price or stock so that reindexSlot only moves the
+    // entries whose key changed
+    struct SlotKeys {
+        Cents price;
+        int quantity;
+        int32_t expiry;
+    };
+
+    SlotKeys slotKeys(size_t slot) const {
+        const Product& product = *inventory[slot];
+        return SlotKeys{product.getPrice(), product.getQuantity(), product.getExpiryDays()};
+    }
+
+    void reindexSlot(size_t slot, const SlotKeys& before) {
+        SlotKeys after = slotKeys(slot);
+        if (stockTotalsBuilt.load(memory_order_relaxed) &&
+            (after.price != before.price || after.quantity != before.quantity)) {
+            CategoryId category = inventory[slot]->getCategoryId();
+            stockTotals.remove(slot, category, before.price, before.quantity, LOW_STOCK_THRESHOLD);
+            stockTotals.add(slot, category, after.price, after.quantity, LOW_STOCK_THRESHOLD);
+        }
+        if (!rangeIndexesBuilt.load(memory_order_relaxed)) return;
+        if (after.price != before.price) {
+            priceIndex.erase(before.price, slot);
+            priceIndex.insert(after.price, slot);
+        }
+        if (after.quantity != before.quantity) {
+            quantityIndex.erase(before.quantity, slot);
+            quantityIndex.insert(after.quantity, slot);
+        }
+        if (after.expiry != before.expiry) {
+            if (before.expiry != NO_EXPIRY) expiryIndex.erase(before.expiry, slot);
+            if (after.expiry != NO_EXPIRY) expiryIndex.insert(after.expiry, slot);
+        }
+        bool wasTracked = before.expiry != NO_EXPIRY && before.quantity > 0;
+        bool tracked = after.expiry != NO_EXPIRY && after.quantity > 0;
+        if (wasTracked != tracked || (tracked && after.expiry != before.expiry)) {
+            expiryHeap.erase(slot);
+            if (tracked) expiryHeap.insert(after.expiry, slot);
+        }
+    }
+
+    void dropDerivedIndexes() {
+        if (rangeIndexesBuilt.load(memory_order_relaxed)) rangeIndexesBuilt.store(false, memory_order_relaxed);
+        if (stockTotalsBuilt.load(memory_order_relaxed)) stockTotalsBuilt.store(false, memory_order_relaxed);
+    }
+
+    // Remove the product in a slot by moving the last product into it
+    void eraseSlot(size_t slot) {
+        idIndex.erase(inventory[slot]->getProductId());
+        handles.erase(slot);
+        if (nameIndexBuilt) nameIndex.removeSlot(slot);
+        unindexSlot(slot);
+        if (slot + 1 != inventory.size()) {
+            unindexSlot(inventory.size() - 1);
+            inventory[slot] = move(inventory.back());
+            idIndex.updateSlot(inventory[slot]->getProductId(), slot);
+            indexSlot(slot);
+        }
+        inventory.pop_back();
+    }
+
+    // Load products from a specific category CSV file
+    CsvLoadReport loadCategoryFromFile(const string& filename, CategoryId category) {
+        CsvLoadReport report;
+        report.filename = filename;
+
+        MappedFile file;
+        if (!file.open(filename)) {
+            return report; // File doesn't exist, skip
+        }
+        loadArenas.push_back(make_unique<ProductArena>(file.contents().size()));
+        parseCategoryRows(file.contents(), category, *loadArenas.back(), report, [this](ProductPtr& product) {
+            return insertProduct(product);
+        });
+        return report;
+    }
+
+    // Keep rejected-row diagnostics collected while loading. Rejected rows
+    // do not make a category dirty, so its file keeps them until the
+    // category itself is changed and saved.
+    void noteLoadProblems(const CsvLoadReport& report) {
+        if (report.rowsRejected == 0) return;
+        note("Skipped " + to_string(report.rowsRejected) + " malformed row(s) in " + report.filename + ":");
+        for (const string& error : report.errors) {
+            note("  " + error);
+        }
+        if (report.rowsRejected > report.errors.size()) {
+            note("  ... and " + to_string(report.rowsRejected - report.errors.size()) + " more");
+        }
+    }
+
+    // Split every present file's data rows into chunks of at least
+    // MIN_CHUNK_BYTES. Quotes are counted per raw piece on the worker pool;
+    // the running parity then tells where each split point is outside a
+    // quoted field, and the split moves to the next such newline.
+    vector<CsvChunk> planChunks(const vector<MappedFile>& files, const vector<bool>& present,
+                                unsigned threads) const {
+        struct Piece {
+            size_t file, begin, end, quotes;
+        };
+        vector<Piece> pieces;
+        vector<size_t> bodyStart(files.size());
+        for (size_t f = 0; f < files.size(); f++) {
+            if (!present[f]) continue;
+            string_view data = files[f].contents();
+            CsvReader header(data);
+            header.nextRecord();
+            bodyStart[f] = header.getOffset();
+            size_t body = data.size() - bodyStart[f];
+            size_t count = max<size_t>(1, min<size_t>(threads * 4, body / MIN_CHUNK_BYTES));
+            for (size_t k = 0; k < count; k++) {
+                pieces.push_back(Piece{f, bodyStart[f] + body * k / count,
+                                       bodyStart[f] + body * (k + 1) / count, 0});
+            }
+        }
+
+        runParallel(pieces.size(), threads, [&](size_t i) {
+            string_view data = files[pieces[i].file].contents();
+            pieces[i].quotes = count(data.begin() + pieces[i].begin, data.begin() + pieces[i].end, '"');
+        });
+
+        vector<CsvChunk> chunks;
+        size_t quotesBefore = 0;
+        for (size_t i = 0; i < pieces.size(); i++) {
+            const Piece& piece = pieces[i];
+            string_view data = files[piece.file].contents();
+            size_t start;
+            if (i == 0 || pieces[i - 1].file != piece.file) {
+                quotesBefore = 0;
+                start = piece.begin;
+            } else {
+                bool inQuotes = quotesBefore % 2 == 1;
+                start = piece.begin;
+                while (start < data.size() && (inQuotes || data[start] != '\n')) {
+                    if (data[start] == '"') inQuotes = !inQuotes;
+                    start++;
+                }
+                start = min(start + 1, data.size());
+                if (start <= chunks.back().begin) start = chunks.back().begin;
+            }
+            quotesBefore += piece.quotes;
+
+            if (!chunks.empty() && chunks.back().file == piece.file) {
+                if (start == chunks.back().begin) continue; // Split collapsed into a long quoted field
+                chunks.back().end = start;
+            }
+            CsvChunk chunk;
+            chunk.file = piece.file;
+            chunk.begin = start;
+            chunk.end = data.size();
+            chunks.push_back(move(chunk));
+        }
+        return chunks;
+    }
+
+    // Merge a file's parsed chunks into the inventory in row order. If the
+    // chunks did not meet on record boundaries (unusual quoting), the file is
+    // re-parsed serially instead so the result never depends on the split.
+    CsvLoadReport mergeChunks(const MappedFile& file, size_t f, vector<CsvChunk>& chunks,
+                              size_t first, size_t last) {
+        CsvLoadReport report;
+        report.filename = categoryFiles[f];
+
+        for (size_t i = first; i + 1 < last; i++) {
+            if (chunks[i].stopRecord != chunks[i + 1].firstRecord) {
+                loadArenas.push_back(make_unique<ProductArena>(file.contents().size()));
+                parseCategoryRows(file.contents(), fileCategories[f], *loadArenas.back(), report,
+                    [this](ProductPtr& product) { return insertProduct(product); });
+                return report;
+            }
+        }
+
+        // Chunk readers number lines from 1; offset them by everything before
+        string_view data = file.contents();
+        size_t lineBase = (first < last) ? count(data.begin(), data.begin() + chunks[first].begin, '\n') : 0;
+        for (size_t i = first; i < last; i++) {
+            CsvChunk& chunk = chunks[i];
+            size_t r = 0;
+            for (size_t p = 0; p < chunk.products.size(); p++) {
+                size_t line = chunk.productLines[p];
+                for (; r < chunk.rejects.size() && chunk.rejects[r].first < line; r++) {
+                    report.reject(lineBase + chunk.rejects[r].first, chunk.rejects[r].second);
+                }
+                if (insertProduct(chunk.products[p])) {
+                    report.rowsLoaded++;
+                } else {
+                    report.reject(lineBase + line, "duplicate product ID " + string(chunk.products[p]->getProductId()));
+                }
+            }
+            for (; r < chunk.rejects.size(); r++) {
+                report.reject(lineBase + chunk.rejects[r].first, chunk.rejects[r].second);
+            }
+            lineBase += chunk.newlines;
+            chunk.products.clear();
+            loadArenas.push_back(move(chunk.arena));
+        }
+        return report;
+    }
+
+public:
+    // Build a product of the given category from CSV fields. On failure returns
+    // nullptr and sets error; never throws on malformed input.
+    static ProductPtr productFromCsvFields(const vector<string_view>& fields, CategoryId category,
+                                           ProductArena& arena, string& error) {
+        size_t required = (category == CategoryRegistry::MEDICINE) ? 7 : 6;
+        if (fields.size() < required) {
+            error = "expected " + to_string(required) + " fields, found " + to_string(fields.size());
+            return nullptr;
+        }
+
+        Cents price;
+        int quantity;
+        if (!parsePriceField(fields[2], price)) {
+            error = "invalid price '" + string(fields[2]) + "'";
+            return nullptr;
+        }
+        if (!parseNumberField(fields[3], quantity)) {
+            error = "invalid quantity '" + string(fields[3]) + "'";
+            return nullptr;
+        }
+
+        switch (category) {
+            case CategoryRegistry::ELECTRONICS: {
+                int warranty;
+                if (!parseNumberField(fields[5], warranty)) {
+                    error = "invalid warranty '" + string(fields[5]) + "'";
+                    return nullptr;
+                }
+                return arena.create<Electronic>(fields[0], fields[1], price, quantity, fields[4], warranty);
+            }
+            case CategoryRegistry::FOOD:
+                return arena.create<Food>(fields[0], fields[1], price, quantity, fields[4], fields[5] == "1");
+            case CategoryRegistry::MEDICINE:
+                return arena.create<Medicine>(fields[0], fields[1], price, quantity, fields[4],
+                                              fields[5], fields[6] == "1");
+            default:
+                error = "no CSV layout for category '" + CategoryRegistry::name(category) + "'";
+                return nullptr;
+        }
+    }
+
+    // Parse data rows until a record starts at or beyond limit (an offset into
+    // the reader's buffer). onProduct(product, line) and onReject(line, reason)
+    // are called in file order.
+    template <typename OnProduct, typename OnReject>
+    static void parseCategoryRecords(CsvReader& reader, CategoryId category, size_t limit, ProductArena& arena,
+                                     OnProduct&& onProduct, OnReject&& onReject) {
+        string error;
+        while (reader.nextRecord() && reader.getRecordOffset() < limit) {
+            const vector<string_view>& fields = reader.getFields();
+            if (reader.hasUnterminatedQuote()) {
+                onReject(reader.getLineNumber(), string("unterminated quoted field"));
+                continue;
+            }
+            if (fields.size() < 4) continue; // Minimum required fields
+
+            ProductPtr product = productFromCsvFields(fields, category, arena, error);
+            if (!product) {
+                onReject(reader.getLineNumber(), error);
+                continue;
+            }
+            onProduct(move(product), reader.getLineNumber());
+        }
+    }
+
+    // Parse every data row of a category CSV buffer (header included) and hand
+    // each product to sink, which takes ownership or returns false to reject
+    // it as a duplicate
+    template <typename Sink>
+    static void parseCategoryRows(string_view data, CategoryId category, ProductArena& arena,
+                                  CsvLoadReport& report, Sink&& sink) {
+        CsvReader reader(data);
+        if (!reader.nextRecord()) return; // Skip header line
+
+        parseCategoryRecords(reader, category, data.size(), arena,
+            [&](ProductPtr&& product, size_t line) {
+                if (sink(product)) {
+                    report.rowsLoaded++;
+                } else {
+                    report.reject(line, "duplicate product ID " + string(product->getProductId()));
+                }
+            },
+            [&](size_t line, const string& reason) { report.reject(line, reason); });
+    }
+
+    // Constructor
+    InventoryManager() {
+        OperationTimer timer(StatOp::Load);
+        if (!loadFromSnapshot()) {
+            timer.discard();
+            loadFromFilesParallel();
+        }
+    }
+
+    // Destructor
+    ~InventoryManager() {
+        saveToFiles();
+        waitForCompaction();
+    }
+
+    // Add product to inventory; DuplicateId if its ID is already taken
+    OpStatus addProduct(ProductPtr product) {
+        OperationTimer timer(StatOp::Update);
+        if (!product) return OpStatus::InvalidProduct;
+        if (!isValidPrice(product->getPrice())) return OpStatus::InvalidPrice;
+        if (!insertProduct(product)) return OpStatus::DuplicateId;
+        return markChanged(*inventory.back()) ? OpStatus::Ok : OpStatus::IoError;
+    }
+
+    // Add a product of the named type ("Electronic", "Food", "Medicine")
+    // from the fields of a row in its category file. InvalidProduct, with
+    // error set, if they do not parse.
+    OpStatus addProductFromCsv(string_view type, const vector<string_view>& fields, string& error) {
+        CategoryId layout;
+        if (!layoutForType(type, layout)) {
+            error = "unknown product type '" + string(type) + "'";
+            return OpStatus::InvalidProduct;
+        }
+        if (loadArenas.empty()) loadArenas.push_back(make_unique<ProductArena>());
+        ProductPtr product = productFromCsvFields(fields, layout, *loadArenas.back(), error);
+        if (!product) return OpStatus::InvalidProduct;
+        return addProduct(move(product));
+    }
+
+    // Search product by ID. The pointer is only good until the product is
+    // removed or the inventory reloaded; keep a handle across other calls.
+    Product* searchById(string_view id) const {
+        OperationTimer timer(StatOp::Lookup);
+        return findProduct(id);
+    }
+
+    // Handle to the product with an ID, or an empty handle if there is none
+    ProductHandle handleOf(string_view id) const {
+        size_t slot = idIndex.find(id);
+        return (slot != ProductIdIndex::npos) ? handles.handleOf(slot) : ProductHandle();
+    }
+
+    // The product a handle refers to, or nullptr once it has been removed.
+    // A product removed and added again gets a new handle.
+    Product* resolve(ProductHandle handle) const {
+        size_t slot = handles.find(handle);
+        return (slot != ProductHandleTable::npos) ? inventory[slot].get() : nullptr;
+    }
+
+    // Edit one field of a product; each change is logged before it returns
+    OpStatus renameProduct(string_view id, string_view name) {
+        OperationTimer timer(StatOp::Update);
+        size_t slot = idIndex.find(id);
+        if (slot == ProductIdIndex::npos) return OpStatus::NotFound;
+        inventory[slot]->setName(name);
+        if (nameIndexBuilt) nameIndex.rename(slot, inventory[slot]->getName());
+        return markChanged(*inventory[slot]) ? OpStatus::Ok : OpStatus::IoError;
+    }
+
+    OpStatus setPrice(string_view id, Cents price) {
+        OperationTimer timer(StatOp::Update);
+        size_t slot = idIndex.find(id);
+        if (slot == ProductIdIndex::npos) return OpStatus::NotFound;
+        if (!isValidPrice(price)) return OpStatus::InvalidPrice;
+        SlotKeys before = slotKeys(slot);
+        inventory[slot]->setPrice(price);
+        reindexSlot(slot, before);
+        return markChanged(*inventory[slot]) ? OpStatus::Ok : OpStatus::IoError;
+    }
+
+    OpStatus setQuantity(string_view id, int quantity) {
+        OperationTimer timer(StatOp::Update);
+        size_t slot = idIndex.find(id);
+        if (slot == ProductIdIndex::npos) return OpStatus::NotFound;
+        SlotKeys before = slotKeys(slot);
+        inventory[slot]->setQuantity(quantity);
+        reindexSlot(slot, before);
+        return markStockChanged(*inventory[slot]) ? OpStatus::Ok : OpStatus::IoError;
+    }
+
+    // The product moves to category's file on the next save, so the file it
+    // leaves is rewritten too
+    OpStatus setCategory(string_view id, string_view category) {
+        OperationTimer timer(StatOp::Update);
+        size_t slot = idIndex.find(id);
+        if (slot == ProductIdIndex::npos) return OpStatus::NotFound;
+        Product* product = inventory[slot].get();
+        CategoryId previousCategory = product->getCategoryId();
+        unindexSlot(slot);
+        product->setCategory(category);
+        indexSlot(slot);
+        dirtyCategories.set(previousCategory);
+        return markChanged(*product) ? OpStatus::Ok : OpStatus::IoError;
+    }
+
+    // Call visit on every product, in inventory order
+    template <typename Visit>
+    void forEachProduct(Visit&& visit) const {
+        for (const auto& product : inventory) visit(static_cast<const Product&>(*product));
+    }
+
+    // Get products by category
+    vector<Product*> getProductsByCategory(CategoryId category) const {
+        vector<Product*> categoryProducts;
+        for (const auto& product : inventory) {
+            if (product->getCategoryId() == category) {
+                categoryProducts.push_back(product.get());
+            }
+        }
+        return categoryProducts;
+    }
+
+    // Category totals, overall totals and the low-stock list from the
+    // running totals; the first report after a load builds them in one pass
+    StockReport stockReport() const {
+        OperationTimer timer(StatOp::Report);
+        buildStockTotals();
+        StockReport report;
+        report.summary = stockTotals.current();
+        vector<uint32_t> lowSlots = stockTotals.lowStockSlots();
+        report.lowStock.reserve(lowSlots.size());
+        for (uint32_t slot : lowSlots) report.lowStock.push_back(inventory[slot].get());
+        return report;
+    }
+
+    // The same report recomputed by a scan of every product
+    StockReport recomputeStockReport() const {
+        StockReport report;
+        report.summary.categories.resize(CategoryRegistry::count());
+        for (const auto& product : inventory) {
+            int quantity = product->getQuantity();
+            Cents value = product->getTotalValue();
+            bool low = quantity < LOW_STOCK_THRESHOLD;
+            if (low) report.lowStock.push_back(product.get());
+            for (CategoryTotals* totals : {&report.summary.categories[product->getCategoryId()], &report.summary.overall}) {
+                totals->products++;
+                totals->items += quantity;
+                totals->value.add(value);
+                totals->lowStock += low;
+            }
+        }
+        return report;
+    }
+
+    // Consistency check of the running totals: true if stockReport() matches
+    // a full recompute, to the cent
+    bool stockTotalsConsistent() const {
+        StockReport running = stockReport(), scanned = recomputeStockReport();
+        auto same = [](const CategoryTotals& a, const CategoryTotals& b) {
+            return a.products == b.products && a.items == b.items && a.lowStock == b.lowStock &&
+                   a.value == b.value;
+        };
+        if (running.summary.categories.size() != scanned.summary.categories.size() ||
+            !same(running.summary.overall, scanned.summary.overall) || running.lowStock != scanned.lowStock) {
+            return false;
+        }
+        for (size_t c = 0; c < scanned.summary.categories.size(); c++) {
+            if (!same(running.summary.categories[c], scanned.summary.categories[c])) return false;
+        }
+        return true;
+    }
+
+    // Products whose name contains term (case-insensitive), in inventory order
+    vector<Product*> findByName(string_view term) const {
+        OperationTimer timer(StatOp::NameSearch);
+        vector<Product*> results;
+        for (size_t slot : builtNameIndex().findSubstring(term)) {
+            results.push_back(inventory[slot].get());
+        }
+        return results;
+    }
+
+    // Up to limit products whose name starts with prefix (case-insensitive),
+    // ordered by name
+    vector<Product*> autocompleteName(string_view prefix, size_t limit = 10) const {
+        OperationTimer timer(StatOp::NameSearch);
+        vector<Product*> results;
+        for (size_t slot : builtNameIndex().findPrefix(prefix, limit)) {
+            results.push_back(inventory[slot].get());
+        }
+        return results;
+    }
+
+    // Adjust a product's stock by change
+    OpStatus updateStock(string_view id, int change) {
+        const Product* product;
+        return updateStock(id, change, product);
+    }
+
+    // The same, also giving the product found, or nullptr, so the caller
+    // can read its new stock without another lookup
+    OpStatus updateStock(string_view id, int change, const Product*& product) {
+        OperationTimer timer(StatOp::Update);
+        size_t slot = idIndex.find(id);
+        product = (slot != ProductIdIndex::npos) ? inventory[slot].get() : nullptr;
+        if (!product) return OpStatus::NotFound;
+        SlotKeys before = slotKeys(slot);
+        bool updated = inventory[slot]->updateStock(change);
+        reindexSlot(slot, before);
+        if (!updated) return OpStatus::StockOverflow;
+        return markStockChanged(*inventory[slot]) ? OpStatus::Ok : OpStatus::IoError;
+    }
+
+    // Range queries over the price, quantity and expiry indexes, in key
+    // order; each costs a binary search plus the products returned.
+    // Products priced from low to high inclusive, cheapest first
+    vector<Product*> findByPriceRange(Cents low, Cents high) const {
+        buildRangeIndexes();
+        vector<Product*> products;
+        priceIndex.forRange(low, high, [&](size_t slot) { products.push_back(inventory[slot].get()); });
+        return products;
+    }
+
+    // Products with low to high units in stock inclusive, fewest first
+    vector<Product*> findByQuantityRange(int low, int high) const {
+        buildRangeIndexes();
+        vector<Product*> products;
+        quantityIndex.forRange(low, high, [&](size_t slot) { products.push_back(inventory[slot].get()); });
+        return products;
+    }
+
+    // Products below threshold units, the low-stock alert list
+    vector<Product*> findLowStock(int threshold = LOW_STOCK_THRESHOLD) const {
+        return findByQuantityRange(INT_MIN, threshold - 1);
+    }
+
+    // Food and medicine expiring between two days since 1970-01-01
+    // inclusive (see parseExpiryDays), soonest first
+    vector<Product*> findExpiringBetween(int32_t fromDay, int32_t toDay) const {
+        buildRangeIndexes();
+        vector<Product*> products;
+        expiryIndex.forRange(fromDay, toDay, [&](size_t slot) { products.push_back(inventory[slot].get()); });
+        return products;
+    }
+
+    // Food and medicine with stock on hand that expire within the next days
+    // days, counting today, or have already expired; soonest first. Answered
+    // from the expiry heap at a cost of k log k for k products returned.
+    vector<Product*> expiringWithin(int days, int32_t today = currentDay()) const {
+        buildRangeIndexes();
+        int64_t lastDay = int64_t(today) + days - 1;
+        if (lastDay < INT32_MIN) return {};
+        vector<pair<int32_t, size_t>> due;
+        expiryHeap.forEachDue(int32_t(min<int64_t>(lastDay, INT32_MAX - 1)),
+                              [&](size_t slot, int32_t day) { due.emplace_back(day, slot); });
+        sort(due.begin(), due.end());
+        vector<Product*> products;
+        products.reserve(due.size());
+        for (const auto& entry : due) products.push_back(inventory[entry.second].get());
+        return products;
+    }
+
+    // Set the stock of every product that expired before today to zero and
+    // log the changes as one batch. Each product pulled costs one heap pop.
+    PullResult pullExpiredStock(int32_t today = currentDay()) {
+        OperationTimer timer(StatOp::Update);
+        buildRangeIndexes();
+        PullResult result;
+        vector<PulledStock>& pulled = result.pulled;
+        string records;
+        bitset<CategoryRegistry::MAX_CATEGORIES> touched;
+        while (!expiryHeap.empty() && expiryHeap.topDay() < today) {
+            size_t slot = expiryHeap.topSlot();
+            Product& product = *inventory[slot];
+            SlotKeys before = slotKeys(slot);
+            pulled.push_back(PulledStock{&product, product.getQuantity()});
+            product.setQuantity(0);
+            reindexSlot(slot, before);
+            touched.set(product.getCategoryId());
+            appendStockRecord(records, product);
+        }
+        if (!logBatch(records, pulled.size(), touched)) result.status = OpStatus::IoError;
+        compactIfDue();
+        return result;
+    }
+
+    // Remove product
+    OpStatus removeProduct(string_view id) {
+        OperationTimer timer(StatOp::Update);
+        size_t slot = idIndex.find(id);
+        if (slot == ProductIdIndex::npos) return OpStatus::NotFound;
+        bool logged = markRemoved(*inventory[slot]);
+        eraseSlot(slot);
+        return logged ? OpStatus::Ok : OpStatus::IoError;
+    }
+
+    // Apply a batch of operations all-or-nothing, without printing. The
+    // batch is grouped by product ID (in ID-index order, keeping batch order
+    // within an ID) and checked in full first; if any operation would fail,
+    // nothing changes and Add operations keep their products. Otherwise each
+    // touched product is updated once with its net result, and one change
+    // log record per ID, holding its final state, is synced as a single
+    // batch before this returns.
+    BatchResult applyBatch(vector<BatchOperation>& operations) {
+        OperationTimer timer(StatOp::Update);
+        BatchResult result;
+        result.statuses.resize(operations.size());
+
+        vector<BatchKey> keys(operations.size());
+        for (size_t i = 0; i < operations.size(); i++) {
+            keys[i] = BatchKey{idIndex.probeOrder(ProductIdIndex::hashOf(operations[i].id())), i};
+        }
+        sortBatchKeys(keys);
+
+        vector<BatchGroup> groups = groupBatchKeys(keys, operations, false);
+        size_t adds = 0;
+        if (!dryRunBatch(keys, groups, operations, result, adds)) {
+            groups = groupBatchKeys(keys, operations, true);
+            dryRunBatch(keys, groups, operations, result, adds);
+        }
+        if (any_of(result.statuses.begin(), result.statuses.end(), [](OpStatus status) { return status != OpStatus::Ok; })) {
+            return result;
+        }
+
+        // Every operation succeeds. IDs with only stock and price changes get
+        // their final values directly, then adds and removes are replayed in
+        // order; removing moves the last product into the freed slot, so
+        // those groups look their slot up again.
+        inventory.reserve(inventory.size() + adds);
+        idIndex.reserve(inventory.size() + adds);
+        string records;
+        bitset<CategoryRegistry::MAX_CATEGORIES> touched;
+        size_t recordCount = 0;
+        for (size_t g = 0; g < groups.size(); g++) {
+            const BatchGroup& group = groups[g];
+#if defined(__GNUC__) || defined(__clang__)
+            if (g + PREFETCH_DISTANCE < groups.size() && groups[g + PREFETCH_DISTANCE].slot != ProductIdIndex::npos) {
+                __builtin_prefetch(inventory[groups[g + PREFETCH_DISTANCE].slot].get());
+            }
+#endif
+            if (group.reshapes) continue;
+            Product& product = *inventory[group.slot];
+            bool restocked = product.getQuantity() != group.quantity;
+            if (!restocked && !group.price) continue;
+            SlotKeys before = slotKeys(group.slot);
+            if (restocked) product.setQuantity(group.quantity);
+            if (group.price) product.setPrice(*group.price);
+            reindexSlot(group.slot, before);
+            touched.set(product.getCategoryId());
+            if (group.price) appendPutRecord(records, product);
+            else appendStockRecord(records, product);
+            recordCount++;
+        }
+
+        for (const BatchGroup& group : groups) {
+            if (!group.reshapes) continue;
+            size_t slot = idIndex.find(operations[keys[group.begin].op].id(), group.hash);
+            const string* removedId = nullptr;
+            for (size_t k = group.begin; k < group.end; k++) {
+                BatchOperation& op = operations[keys[k].op];
+                switch (op.kind) {
+                    case BatchOperation::Kind::Add:
+                        slot = inventory.size();
+                        insertProduct(op.product, group.hash);
+                        break;
+                    case BatchOperation::Kind::AdjustStock: {
+                        SlotKeys before = slotKeys(slot);
+                        inventory[slot]->updateStock(op.quantityChange);
+                        reindexSlot(slot, before);
+                        break;
+                    }
+                    case BatchOperation::Kind::SetPrice: {
+                        SlotKeys before = slotKeys(slot);
+                        inventory[slot]->setPrice(op.price);
+                        reindexSlot(slot, before);
+                        break;
+                    }
+                    case BatchOperation::Kind::Remove:
+                        touched.set(inventory[slot]->getCategoryId());
+                        eraseSlot(slot);
+                        slot = ProductIdIndex::npos;
+                        removedId = &op.productId;
+                        break;
+                }
+            }
+            if (slot != ProductIdIndex::npos) {
+                touched.set(inventory[slot]->getCategoryId());
+                appendPutRecord(records, *inventory[slot]);
+            } else {
+                appendDelRecord(records, *removedId);
+            }
+            recordCount++;
+        }
+
+        if (!logBatch(records, recordCount, touched)) {
+            for (OpStatus& status : result.statuses) {
+                if (status == OpStatus::Ok) status = OpStatus::IoError;
+            }
+        }
+        compactIfDue();
+        result.applied = true;
+        return result;
+    }
+
+    // Save inventory to category-specific CSV files
+    // Only categories changed since the last save are rewritten; in
+    // change-log mode the changes are already durable in the log. False if
+    // a file could not be written; the error is in takeMessages().
+    bool saveToFiles() {
+        OperationTimer timer(StatOp::Save);
+        syncPendingChanges();
+        // Unless the log lost changes, which only the CSV files can keep now
+        if (saveMode == SaveMode::ChangeLog && !hasLogFailure()) return true;
+
+        waitForCompaction();
+        bool saved = true;
+        bool written = false;
+        for (size_t f = 0; f < categoryFiles.size(); f++) {
+            CategoryId category = fileCategories[f];
+            if (!dirtyCategories.test(category)) continue;
+            if (saveCategoryToFile(category, categoryFiles[f])) {
+                dirtyCategories.reset(category);
+                written = true;
+            } else {
+                saved = false;
+            }
+        }
+        if (saved && snapshotEnabled && (written || !snapshotCurrent)) {
+            snapshotCurrent = writeSnapshot();
+        }
+        if (saved) {
+            // Every logged change is in the CSV files now, including any left
+            // by a compaction that failed
+            changeLog.close();
+            remove(COMPACTING_LOG_FILE);
+            remove(CHANGE_LOG_FILE);
+            clearLogFailure();
+            logRecords = 0;
+        }
+        return saved;
+    }
+
+    // Load the binary snapshot if it still matches the CSV files, then replay
+    // the change logs. Returns false, leaving the inventory untouched, if
+    // there is no usable snapshot. Products are built on a worker pool;
+    // threads == 0 uses every core.
+    bool loadFromSnapshot(unsigned threads = 0) {
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        waitForCompaction();
+        MappedFile file;
+        if (!file.open(SNAPSHOT_FILE)) return false;
+        string_view data = file.contents();
+
+        SnapshotHeader header;
+        SnapshotTrailer trailer;
+        if (data.size() < sizeof(header) + sizeof(trailer)) return false;
+        memcpy(&header, data.data(), sizeof(header));
+        memcpy(&trailer, data.data() + data.size() - sizeof(trailer), sizeof(trailer));
+        if (memcmp(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SnapshotHeader::VERSION || header.productCount > data.size() ||
+            header.categoryCount > CategoryRegistry::MAX_CATEGORIES || trailer.heapBytes > data.size()) {
+            return false;
+        }
+        SnapshotLayout layout(header.productCount, header.categoryCount, trailer.heapBytes);
+        if (layout.total != data.size()) return false;
+        array<SnapshotFileStamp, 3> stamps = currentFileStamps();
+        for (size_t f = 0; f < stamps.size(); f++) {
+            if (stamps[f].size != header.files[f].size || stamps[f].modified != header.files[f].modified) {
+                return false; // The CSV files changed since the snapshot
+            }
+        }
+        SnapshotChecksum checksum;
+        checksum.update(data.substr(0, data.size() - sizeof(trailer.checksum)));
+        if (checksum.finish() != trailer.checksum) {
+            note(string("Warning: ") + SNAPSHOT_FILE + " is corrupt; loading the CSV files instead.");
+            return false;
+        }
+
+        size_t count = header.productCount;
+        string_view heap = data.substr(layout.heap, trailer.heapBytes);
+        auto column = [&data](size_t offset) { return data.data() + offset; };
+        auto text = [&heap](const SnapshotStringRef& ref, string_view& out) {
+            if (ref.offset > heap.size() || ref.length > heap.size() - ref.offset) return false;
+            out = heap.substr(ref.offset, ref.length);
+            return true;
+        };
+        const auto* categoryRefs = reinterpret_cast<const SnapshotStringRef*>(column(layout.categories));
+        vector<CategoryId> categories(header.categoryCount);
+        for (size_t c = 0; c < categories.size(); c++) {
+            string_view name;
+            if (!text(categoryRefs[c], name)) return false;
+            categories[c] = CategoryRegistry::intern(name);
+        }
+        const auto* layouts = reinterpret_cast<const uint8_t*>(column(layout.layout));
+        const auto* categoryIndex = reinterpret_cast<const uint8_t*>(column(layout.category));
+        const auto* flags = reinterpret_cast<const uint8_t*>(column(layout.flag));
+        const auto* prices = reinterpret_cast<const Cents*>(column(layout.price));
+        const auto* quantities = reinterpret_cast<const int32_t*>(column(layout.quantity));
+        const auto* warranties = reinterpret_cast<const int32_t*>(column(layout.warranty));
+        const SnapshotStringRef* strings[SnapshotLayout::STRING_COLUMNS];
+        for (size_t k = 0; k < SnapshotLayout::STRING_COLUMNS; k++) {
+            strings[k] = reinterpret_cast<const SnapshotStringRef*>(column(layout.strings[k]));
+        }
+
+        struct Piece {
+            size_t begin, end;
+            unique_ptr<ProductArena> arena;
+            vector<ProductPtr> products;
+            vector<size_t> idHashes;
+            bool valid = true;
+        };
+        size_t pieceCount = max<size_t>(1, min<size_t>(threads * 4, count / MIN_SNAPSHOT_PIECE));
+        vector<Piece> pieces(pieceCount);
+        runParallel(pieceCount, threads, [&](size_t p) {
+            Piece& piece = pieces[p];
+            piece.begin = count * p / pieceCount;
+            piece.end = count * (p + 1) / pieceCount;
+            piece.arena = make_unique<ProductArena>((piece.end - piece.begin) * 192);
+            piece.products.reserve(piece.end - piece.begin);
+            piece.idHashes.reserve(piece.end - piece.begin);
+            for (size_t i = piece.begin; i < piece.end && piece.valid; i++) {
+                string_view id, name, text1, text2;
+                if (!text(strings[0][i], id) || !text(strings[1][i], name) || !text(strings[2][i], text1) ||
+                    !text(strings[3][i], text2) || categoryIndex[i] >= categories.size() ||
+                    prices[i] < 0 || prices[i] > MAX_PRICE_CENTS) {
+                    piece.valid = false;
+                    break;
+                }
+                ProductPtr product;
+                switch (layouts[i]) {
+                    case CategoryRegistry::ELECTRONICS:
+                        product = piece.arena->create<Electronic>(id, name, prices[i], quantities[i], text1, warranties[i]);
+                        break;
+                    case CategoryRegistry::FOOD:
+                        product = piece.arena->create<Food>(id, name, prices[i], quantities[i], text1, flags[i] != 0);
+                        break;
+                    case CategoryRegistry::MEDICINE:
+                        product = piece.arena->create<Medicine>(id, name, prices[i], quantities[i], text1, text2,
+                                                                flags[i] != 0);
+                        break;
+                    default:
+                        piece.valid = false;
+                        continue;
+                }
+                product->setCategoryId(categories[categoryIndex[i]]);
+                piece.products.push_back(move(product));
+                piece.idHashes.push_back(ProductIdIndex::hashOf(id));
+            }
+        });
+        for (const Piece& piece : pieces) {
+            if (!piece.valid) {
+                note(string("Warning: ") + SNAPSHOT_FILE + " is corrupt; loading the CSV files instead.");
+                return false;
+            }
+        }
+
+        resetChangeTracking();
+        idIndex.clear();
+        handles.clear();
+        nameIndex.clear();
+        nameIndexBuilt = false;
+        rangeIndexesBuilt = false;
+        stockTotalsBuilt = false;
+        inventory.clear();
+        loadArenas.clear();
+        inventory.reserve(count);
+        idIndex.reserve(count);
+        handles.reserve(count);
+        // Index in order with the hashes from the workers, prefetching a few
+        // products ahead since table accesses are random
+        constexpr size_t PREFETCH_DISTANCE = 8;
+        for (Piece& piece : pieces) {
+            for (size_t i = 0; i < piece.products.size(); i++) {
+                if (i + PREFETCH_DISTANCE < piece.idHashes.size()) {
+                    idIndex.prefetch(piece.idHashes[i + PREFETCH_DISTANCE]);
+                }
+                insertProduct(piece.products[i], piece.idHashes[i]);
+            }
+            piece.products.clear();
+            loadArenas.push_back(move(piece.arena));
+        }
+        snapshotCurrent = true;
+        replayChangeLogs();
+
+        note("Loaded " + to_string(inventory.size()) + " products from " + SNAPSHOT_FILE + ".");
+        return true;
+    }
+
+    // Load inventory from category-specific CSV files
+    void loadFromFiles() {
+        OperationTimer timer(StatOp::Load);
+        resetChangeTracking();
+        idIndex.clear();
+        handles.clear();
+        nameIndex.clear();
+        nameIndexBuilt = false;
+        rangeIndexesBuilt = false;
+        stockTotalsBuilt = false;
+        inventory.clear();
+        loadArenas.clear();
+        
+        for (size_t f = 0; f < categoryFiles.size(); f++) {
+            noteLoadProblems(loadCategoryFromFile(categoryFiles[f], fileCategories[f]));
+        }
+        replayChangeLogs();
+        
+        note("Loaded " + to_string(inventory.size()) + " products from category-specific CSV files.");
+    }
+
+    // Load the category files concurrently, splitting large files into
+    // newline-aligned chunks parsed by a worker pool. Results are merged in
+    // file and row order, so the inventory, ID index and reported problems
+    // are identical to loadFromFiles(). threads == 0 uses every core.
+    void loadFromFilesParallel(unsigned threads = 0) {
+        OperationTimer timer(StatOp::Load);
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        resetChangeTracking();
+        idIndex.clear();
+        handles.clear();
+        nameIndex.clear();
+        nameIndexBuilt = false;
+        rangeIndexesBuilt = false;
+        stockTotalsBuilt = false;
+        inventory.clear();
+        loadArenas.clear();
+
+        const size_t fileCount = categoryFiles.size();
+        vector<MappedFile> files(fileCount);
+        vector<bool> present(fileCount);
+        for (size_t f = 0; f < fileCount; f++) {
+            present[f] = files[f].open(categoryFiles[f]);
+        }
+
+        vector<CsvChunk> chunks = planChunks(files, present, threads);
+
+        runParallel(chunks.size(), threads, [&](size_t i) {
+            CsvChunk& chunk = chunks[i];
+            string_view data = files[chunk.file].contents();
+            CsvReader reader(data.substr(chunk.begin));
+            chunk.arena = make_unique<ProductArena>(chunk.end - chunk.begin);
+            parseCategoryRecords(reader, fileCategories[chunk.file], chunk.end - chunk.begin, *chunk.arena,
+                [&](ProductPtr&& product, size_t line) {
+                    chunk.products.push_back(move(product));
+                    chunk.productLines.push_back(line);
+                },
+                [&](size_t line, const string& reason) { chunk.rejects.emplace_back(line, reason); });
+            chunk.stopRecord = chunk.begin + reader.getRecordOffset();
+            CsvReader first(data.substr(chunk.begin));
+            first.nextRecord();
+            chunk.firstRecord = chunk.begin + first.getRecordOffset();
+            chunk.newlines = count(data.begin() + chunk.begin, data.begin() + chunk.end, '\n');
+        });
+
+        size_t parsed = 0;
+        for (const CsvChunk& chunk : chunks) parsed += chunk.products.size();
+        inventory.reserve(parsed);
+        idIndex.reserve(parsed);
+        handles.reserve(parsed);
+
+        size_t next = 0;
+        for (size_t f = 0; f < fileCount; f++) {
+            size_t last = next;
+            while (last < chunks.size() && chunks[last].file == f) last++;
+            if (present[f]) {
+                noteLoadProblems(mergeChunks(files[f], f, chunks, next, last));
+            }
+            next = last;
+        }
+        replayChangeLogs();
+
+        note("Loaded " + to_string(inventory.size()) + " products from category-specific CSV files.");
+    }
+
+    // Export specific category to CSV, only the products keep() accepts
+    // (e.g. [](const Product& p) { return p.getQuantity() < 10; }); NotFound
+    // if the category has no products. Rows are formatted in parallel and
+    // streamed to the file in order.
+    template <typename Keep = AcceptAll>
+    OpStatus exportCategoryToCsv(const string& category, const string& exportFilename,
+                                 const Keep& keep = Keep()) const {
+        CategoryId id;
+        if (!CategoryRegistry::find(category, id) || !hasProductsIn(id)) return OpStatus::NotFound;
+
+        ofstream file(exportFilename, ios::binary);
+        if (!file.is_open()) return OpStatus::IoError;
+        formatCategoryCsv(id, [&file](string_view block) { file.write(block.data(), block.size()); }, keep);
+        file.close();
+        return file ? OpStatus::Ok : OpStatus::IoError;
+    }
+
+    size_t getProductCount() const { return inventory.size(); }
+
+    // Messages noted since the last call, oldest first: what the last load
+    // found and any file that could not be written
+    vector<string> takeMessages() {
+        lock_guard<mutex> lock(messageMutex);
+        vector<string> taken;
+        taken.swap(messages);
+        return taken;
+    }
+
+    void setSaveMode(SaveMode mode) { saveMode = mode; }
+    // Saves also write inventory.snapshot, which the next start loads
+    // instead of parsing the CSV files (on by default)
+    void setSnapshotEnabled(bool enabled) { snapshotEnabled = enabled; }
+    SaveMode getSaveMode() const { return saveMode; }
+
+    // While deferred, changes are appended to the change log in memory and
+    // synced together by syncPendingChanges() (or by turning deferral off),
+    // instead of one sync each. Only for callers that report no change
+    // before syncing it, like the command mode: a crash loses what is pending.
+    void setSyncDeferred(bool deferred) {
+        unique_lock<mutex> lock(logMutex);
+        syncDeferred = deferred;
+        if (!deferred) waitForSync(lock, appendedRecords);
+    }
+
+    // False if a pending change could not be written to the change log
+    bool syncPendingChanges() {
+        unique_lock<mutex> lock(logMutex);
+        return waitForSync(lock, appendedRecords);
+    }
+
+    // Fold the change log into the CSV files now instead of waiting for it
+    // to grow; the files are written in the background
+    void compactChangeLog() {
+        if (logRecords > 0) startCompaction();
+    }
+
+    // Columnar snapshot of the current inventory for analytics scans. The
+    // snapshot does not track later changes; rebuild it after updates.
+    ColumnarInventory buildColumnarStore() const {
+        ColumnarInventory columns;
+        columns.reserve(inventory.size());
+        for (const auto& product : inventory) {
+            columns.append(*product);
+        }
+        columns.syncCategoryNames();
+        return columns;
+    }
+
+    // Get available categories
+    vector<string> getAvailableCategories() const {
+        vector<CategoryId> seen;
+        vector<string> categories;
+        for (const auto& product : inventory) {
+            CategoryId category = product->getCategoryId();
+            if (find(seen.begin(), seen.end(), category) == seen.end()) {
+                seen.push_back(category);
+                categories.push_back(product->getCategory());
+            }
+        }
+        return categories;
+    }
+};
+
+// Thread-safe access to one InventoryManager from many worker threads.
+// Products are sharded by ID hash with a reader/writer lock per shard:
+// lookups share their shard's lock and edits such as a price change hold
+// it exclusively, so a writer only blocks work on its own shard. Stock is
+// atomic on the product, so stock changes need only the shared lock.
+// Adding or removing a product reshapes the manager's product array and
+// ID index, so it takes every shard lock; reports take every lock shared.
+// Stock and price changes drop the manager's range indexes, which its next
+// range query rebuilds.
+// Each change is synced to the change log (group-committed across threads)
+// before it returns.
+class ConcurrentInventory {
+private:
+    static constexpr size_t SHARD_COUNT = 64;
+
+    // One lock per cache line so shards do not contend through false sharing
+    struct alignas(64) Shard {
+        shared_mutex lock;
+    };
+
+    InventoryManager& manager;
+    mutable array<Shard, SHARD_COUNT> shards;
+
+    shared_mutex& shardLock(string_view id) const {
+        return shards[ProductIdIndex::hashOf(id) % SHARD_COUNT].lock;
+    }
+
+    // Every shard lock, always taken in shard order
+    template <typename Lock>
+    vector<Lock> lockAllShards() const {
+        vector<Lock> locks;
+        locks.reserve(SHARD_COUNT);
+        for (Shard& shard : shards) locks.emplace_back(shard.lock);
+        return locks;
+    }
+
+public:
+    explicit ConcurrentInventory(InventoryManager& manager) : manager(manager) {}
+
+    // Call read with the product while its shard is locked for reading;
+    // false if the ID is unknown. The product must not escape read.
+    template <typename Read>
+    bool readProduct(string_view id, Read&& read) const {
+        shared_lock<shared_mutex> lock(shardLock(id));
+        const Product* product = manager.searchById(id);
+        if (!product) return false;
+        read(*product);
+        return true;
+    }
+
+    // Adjust a product's stock by change; false if the ID is unknown, the
+    // stock would overflow or the change could not be logged. Every change
+    // below is undone if it could not be logged.
+    bool updateStock(string_view id, int change) {
+        OperationTimer timer(StatOp::Update);
+        shared_lock<shared_mutex> lock(shardLock(id));
+        Product* product = manager.findProduct(id);
+        if (!product) return false;
+        manager.dropDerivedIndexes();
+        if (!product->updateStock(change)) return false;
+        if (manager.logStock(*product)) return true;
+        product->undoStockUpdate(change);
+        return false;
+    }
+
+    // Stock held for a checkout; empty if the ID is unknown or fewer than
+    // count units are available
+    struct Reservation {
+        string productId;
+        int count = 0;
+        explicit operator bool() const { return count > 0; }
+    };
+
+    Reservation reserveStock(string_view id, int count) {
+        OperationTimer timer(StatOp::Update);
+        shared_lock<shared_mutex> lock(shardLock(id));
+        Product* product = manager.findProduct(id);
+        if (!product || !product->reserveStock(count)) return {};
+        return {string(id), count};
+    }
+
+    // Sell the held units; false if the product has gone since the
+    // reservation or its on-hand stock was cut below them. The units stay
+    // held, for releaseReservation, if the sale fails.
+    bool commitReservation(Reservation& reservation) {
+        OperationTimer timer(StatOp::Update);
+        shared_lock<shared_mutex> lock(shardLock(reservation.productId));
+        Product* product = manager.findProduct(reservation.productId);
+        if (!product) {
+            reservation.count = 0;
+            return false;
+        }
+        manager.dropDerivedIndexes();
+        if (!product->commitReservation(reservation.count)) return false;
+        if (!manager.logStock(*product)) {
+            product->undoCommit(reservation.count);
+            return false;
+        }
+        reservation.count = 0;
+        return true;
+    }
+
+    void releaseReservation(Reservation& reservation) {
+        OperationTimer timer(StatOp::Update);
+        shared_lock<shared_mutex> lock(shardLock(reservation.productId));
+        if (Product* product = manager.findProduct(reservation.productId)) {
+            product->releaseReservation(reservation.count);
+        }
+        reservation.count = 0;
+    }
+
+    bool setPrice(string_view id, Cents price) {
+        OperationTimer timer(StatOp::Update);
+        if (!isValidPrice(price)) return false;
+        unique_lock<shared_mutex> lock(shardLock(id));
+        Product* product = manager.findProduct(id);
+        if (!product) return false;
+        manager.dropDerivedIndexes();
+        Cents previous = product->getPrice();
+        product->setPrice(price);
+        if (manager.logPut(*product)) return true;
+        product->setPrice(previous);
+        return false;
+    }
+
+    // False, leaving product with the caller, if its ID is already taken,
+    // its price is out of range or it could not be logged
+    bool addProduct(ProductPtr& product) {
+        OperationTimer timer(StatOp::Update);
+        if (!isValidPrice(product->getPrice())) return false;
+        auto locks = lockAllShards<unique_lock<shared_mutex>>();
+        if (manager.idIndex.find(product->getProductId()) != ProductIdIndex::npos) return false;
+        if (!manager.logPut(*product)) return false;
+        manager.insertProduct(product);
+        manager.compactIfDue();
+        return true;
+    }
+
+    bool removeProduct(string_view id) {
+        OperationTimer timer(StatOp::Update);
+        auto locks = lockAllShards<unique_lock<shared_mutex>>();
+        size_t slot = manager.idIndex.find(id);
+        if (slot == ProductIdIndex::npos) return false;
+        if (!manager.markRemoved(*manager.inventory[slot])) return false;
+        manager.eraseSlot(slot);
+        return true;
+    }
+
+    BatchResult applyBatch(vector<BatchOperation>& operations) {
+        auto locks = lockAllShards<unique_lock<shared_mutex>>();
+        return manager.applyBatch(operations);
+    }
+
+    // Per-category and overall stock totals. Adds, removes and edits wait for
+    // the scan; stock changes carry on, each product's stock read atomically.
+    StockSummary summarize() const {
+        OperationTimer timer(StatOp::Report);
+        auto locks = lockAllShards<shared_lock<shared_mutex>>();
+        StockSummary summary;
+        summary.categories.resize(CategoryRegistry::count());
+        for (const auto& product : manager.inventory) {
+            int quantity = product->getQuantity();
+            Cents value = product->getTotalValue();
+            bool low = quantity < InventoryManager::LOW_STOCK_THRESHOLD;
+            for (CategoryTotals* totals : {&summary.categories[product->getCategoryId()], &summary.overall}) {
+                totals->products++;
+                totals->items += quantity;
+                totals->value.add(value);
+                totals->lowStock += low;
+            }
+        }
+        return summary;
+    }
+
+    size_t size() const {
+        // Any one shard lock excludes adds and removes
+        shared_lock<shared_mutex> lock(shards[0].lock);
+        return manager.getProductCount();
+    }
+
+    // Save through the manager with every shard quiesced
+    bool saveToFiles() {
+        auto locks = lockAllShards<unique_lock<shared_mutex>>();
+        return manager.saveToFiles();
+    }
+};
+
+#if IMS_HAVE_EPOLL
+// Query server: many clients share one in-memory inventory over a Unix
+// socket or loopback TCP. A single thread runs an epoll loop, so the
+// manager needs no locking. Requests are CSV lines, answered one line each
+// and in order, so a client may pipeline any number of them:
+//   get,<id>              OK,<type>,<category>,<CSV row>
+//   stock,<id>,<change>   OK,<new quantity>
+//   report                OK,<products>,<items>,<value>,<low stock>
+// and ERR,<message> when a request fails. Stock changes from every
+// connection served in one loop round are synced to the change log together
+// before any of their responses is sent.
+class InventoryServer {
+private:
+    static constexpr size_t MAX_EVENTS = 256;
+    static constexpr size_t READ_BYTES = 64 * 1024;
+    // A connection is not read again until the client takes its responses
+    static constexpr size_t MAX_BUFFERED_OUTPUT = 4 << 20;
+    // Longest request line; a longer one closes the connection
+    static constexpr size_t MAX_REQUEST_BYTES = 64 * 1024;
+
+    struct Connection {
+        string input;         // Received bytes not yet answered
+        string output;        // Responses not yet sent
+        size_t sent = 0;
+        bool writing = false; // Waiting for the socket to take output
+        bool closing = false; // The client is done sending; close once answered
+        bool unsynced = false; // Was answered OK to a change not synced yet
+    };
+
+    InventoryManager& manager;
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+    string unixPath;          // Unlinked on shutdown
+    unordered_map<int, Connection> connections;
+    vector<int> answered;     // Connections with responses this round
+    vector<char> readBuffer;
+
+    static bool setNonBlocking(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    void watch(int fd, uint32_t events, int op) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, op, fd, &event);
+    }
+
+    void closeConnection(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections.erase(fd);
+    }
+
+    void acceptConnections() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return; // EAGAIN, or an error we retry on the next event
+            if (unixPath.empty()) {
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            connections[fd];
+            watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+        }
+    }
+
+    static void appendError(string& out, string_view message) {
+        out += "ERR,";
+        Product::appendCsvField(out, message);
+        out += '\n';
+    }
+
+    // Answer one request
+    void respond(const vector<string_view>& fields, Connection& connection) {
+        string& out = connection.output;
+        string_view request = fields[0];
+        if (request == "get" && fields.size() == 2) {
+            const Product* product = manager.searchById(fields[1]);
+            if (!product) return appendError(out, "product not found");
+            out += "OK,";
+            out += product->getProductType();
+            out += ',';
+            Product::appendCsvField(out, product->getCategory());
+            out += ',';
+            product->toCsvRow(out);
+            out += '\n';
+        } else if (request == "stock" && fields.size() == 3) {
+            int change;
+            if (!parseNumberField(fields[2], change)) return appendError(out, "invalid stock change");
+            const Product* product;
+            OpStatus status = manager.updateStock(fields[1], change, product);
+            if (status == OpStatus::NotFound) return appendError(out, "product not found");
+            if (status == OpStatus::StockOverflow) return appendError(out, "stock would overflow");
+            if (status == OpStatus::IoError) return appendError(out, "stock changed but not logged; kept only by the next save");
+            connection.unsynced = true;
+            out += "OK,";
+            Product::appendCsvNumber(out, product->getQuantity());
+            out += '\n';
+        } else if (request == "report" && fields.size() == 1) {
+            StockReport report = manager.stockReport();
+            const CategoryTotals& overall = report.summary.overall;
+            out += "OK,";
+            appendPadded(out, static_cast<long long>(overall.products));
+            out += ',';
+            appendPadded(out, overall.items);
+            out += ',';
+            appendMoney(out, overall.value);
+            out += ',';
+            appendPadded(out, static_cast<long long>(report.lowStock.size()));
+            out += '\n';
+        } else {
+            appendError(out, "unknown request");
+        }
+    }
+
+    // Answer every complete line received so far
+    void answerRequests(int fd, Connection& connection) {
+        size_t end = connection.input.rfind('\n');
+        if (end == string::npos) return;
+        CsvReader reader(string_view(connection.input).substr(0, end + 1));
+        size_t before = connection.output.size();
+        while (reader.nextRecord()) {
+            if (reader.hasUnterminatedQuote()) {
+                appendError(connection.output, "unterminated quoted field");
+            } else {
+                respond(reader.getFields(), connection);
+            }
+        }
+        connection.input.erase(0, end + 1);
+        if (connection.output.size() > before) answered.push_back(fd);
+    }
+
+    void readRequests(int fd, Connection& connection) {
+        ssize_t received = ::read(fd, readBuffer.data(), readBuffer.size());
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EINTR) closeConnection(fd);
+            return;
+        }
+        if (received == 0) {
+            // Stop reading; the responses still owed are sent this round
+            connection.closing = true;
+            connection.writing = false;
+            watch(fd, 0, EPOLL_CTL_MOD);
+            answered.push_back(fd);
+            return;
+        }
+        connection.input.append(readBuffer.data(), static_cast<size_t>(received));
+        answerRequests(fd, connection);
+        if (connection.input.size() > MAX_REQUEST_BYTES) closeConnection(fd);
+    }
+
+    // Send what the socket takes; the rest waits for EPOLLOUT, and the
+    // connection is not read while it is over MAX_BUFFERED_OUTPUT
+    void sendResponses(int fd, Connection& connection) {
+        while (connection.sent < connection.output.size()) {
+            ssize_t sent = ::send(fd, connection.output.data() + connection.sent,
+                                  connection.output.size() - connection.sent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN) return closeConnection(fd);
                 break;
             }
-            default:
-                cout << "Invalid choice!\n";
-                return;
+            connection.sent += static_cast<size_t>(sent);
+        }
+        if (connection.sent == connection.output.size()) {
+            connection.output.clear();
+            connection.sent = 0;
+        }
+        if (connection.closing && connection.output.empty()) return closeConnection(fd);
+        bool writing = !connection.output.empty();
+        if (writing != connection.writing) {
+            connection.writing = writing;
+            uint32_t events = writing ? EPOLLOUT : 0u;
+            if (!connection.closing && connection.output.size() - connection.sent < MAX_BUFFERED_OUTPUT) {
+                events |= EPOLLIN | EPOLLRDHUP;
+            }
+            watch(fd, events, EPOLL_CTL_MOD);
         }
-        cout << "Product updated successfully!\n";
     }
 
-    // Display all products
-    void displayAllProducts() const {
-        if (inventory.empty()) {
-            cout << "No products in inventory!\n";
-            return;
-        }
+public:
+    explicit InventoryServer(InventoryManager& m) : manager(m), readBuffer(READ_BYTES) {}
+    InventoryServer(const InventoryServer&) = delete;
+    InventoryServer& operator=(const InventoryServer&) = delete;
 
-        cout << "\n" << string(100, '=') << endl;
-        cout << "                          INVENTORY REPORT" << endl;
-        cout << string(100, '=') << endl;
+    ~InventoryServer() {
+        for (auto& entry : connections) ::close(entry.first);
+        if (listenFd >= 0) ::close(listenFd);
+        if (epollFd >= 0) ::close(epollFd);
+        if (wakeFd >= 0) ::close(wakeFd);
+        if (!unixPath.empty()) unlink(unixPath.c_str());
+    }
 
-        cout << left << setw(12) << "ID" << setw(20) << "Name" 
-             << setw(12) << "Category" << setw(10) << "Price" 
-             << setw(8) << "Stock" << setw(15) << "Extra Info" 
-             << setw(12) << "Details" << endl;
-        cout << string(100, '-') << endl;
+    // Listen on a Unix socket path (any address containing '/') or on a
+    // loopback TCP "port" or "host:port"; false with error set on failure
+    bool listen(const string& address, string& error) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0) {
+            error = "could not create the event loop";
+            return false;
+        }
 
-        for (const auto& product : inventory) {
-            product->displayDetails();
+        if (address.find('/') != string::npos) {
+            sockaddr_un local{};
+            if (address.size() >= sizeof(local.sun_path)) {
+                error = "socket path too long";
+                return false;
+            }
+            local.sun_family = AF_UNIX;
+            memcpy(local.sun_path, address.c_str(), address.size() + 1);
+            listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            unlink(address.c_str());
+            if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+                error = "could not bind " + address;
+                return false;
+            }
+            unixPath = address;
+        } else {
+            size_t colon = address.rfind(':');
+            string host = (colon == string::npos) ? "127.0.0.1" : address.substr(0, colon);
+            uint16_t port = 0;
+            sockaddr_in inet{};
+            inet.sin_family = AF_INET;
+            if (!parseNumberField(string_view(address).substr(colon == string::npos ? 0 : colon + 1), port) ||
+                inet_pton(AF_INET, host.c_str(), &inet.sin_addr) != 1) {
+                error = "expected a socket path, port or host:port, got '" + address + "'";
+                return false;
+            }
+            inet.sin_port = htons(port);
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int on = 1;
+            if (listenFd >= 0) setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr*>(&inet), sizeof(inet)) != 0) {
+                error = "could not bind " + address;
+                return false;
+            }
         }
-        cout << string(100, '=') << endl;
+        if (::listen(listenFd, SOMAXCONN) != 0) {
+            error = "could not listen on " + address;
+            return false;
+        }
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+        return true;
     }
 
-    // Display products by category
-    void displayProductsByCategory(const string& category) const {
-        vector<Product*> categoryProducts = getProductsByCategory(category);
-        
-        if (categoryProducts.empty()) {
-            cout << "No products found in " << category << " category!\n";
-            return;
+    // Serve until stop() is called
+    void run() {
+        manager.setSyncDeferred(true);
+        epoll_event events[MAX_EVENTS];
+        bool stopping = false;
+        while (!stopping) {
+            int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (int i = 0; i < ready; i++) {
+                int fd = events[i].data.fd;
+                if (fd == wakeFd) {
+                    stopping = true;
+                } else if (fd == listenFd) {
+                    acceptConnections();
+                } else {
+                    auto found = connections.find(fd);
+                    if (found == connections.end()) continue;
+                    if (events[i].events & EPOLLOUT) {
+                        sendResponses(fd, found->second);
+                        found = connections.find(fd);
+                        if (found == connections.end()) continue;
+                    }
+                    if (!found->second.closing && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                        readRequests(fd, found->second);
+                    } else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                        closeConnection(fd);
+                    }
+                }
+            }
+
+            // One sync covers every stock change of the round. If it failed
+            // those changes are not acknowledged: clients that made one get
+            // their connection closed instead of an OK, and the rest are
+            // answered as usual.
+            bool synced = manager.syncPendingChanges();
+            for (int fd : answered) {
+                auto found = connections.find(fd);
+                if (found == connections.end()) continue;
+                if (!synced && found->second.unsynced) {
+                    closeConnection(fd);
+                    continue;
+                }
+                found->second.unsynced = false;
+                sendResponses(fd, found->second);
+            }
+            answered.clear();
         }
+        manager.setSyncDeferred(false);
+    }
 
-        cout << "\n" << string(100, '=') << endl;
-        cout << "                    " << category << " INVENTORY" << endl;
-        cout << string(100, '=') << endl;
+    // Make run() return; safe to call from another thread or a signal handler
+    void stop() {
+        uint64_t one = 1;
+        ssize_t written = ::write(wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+};
+#endif
 
-        cout << left << setw(12) << "ID" << setw(20) << "Name" 
-             << setw(12) << "Category" << setw(10) << "Price" 
-             << setw(8) << "Stock" << setw(15) << "Extra Info" 
-             << setw(12) << "Details" << endl;
-        cout << string(100, '-') << endl;
+// Builds a whole screen of console output (a table, a report, a menu) in
+// one buffer and writes it with a single call instead of flushing per line
+class ConsoleRenderer {
+private:
+    string out;
 
-        for (const auto& product : categoryProducts) {
-            product->displayDetails();
-        }
-        cout << string(100, '=') << endl;
+public:
+    ConsoleRenderer& text(string_view value) {
+        out += value;
+        return *this;
     }
 
-    // Generate stock report
-    void generateStockReport() const {
-        if (inventory.empty()) {
-            cout << "No products in inventory!\n";
-            return;
-        }
+    ConsoleRenderer& line(string_view value = {}) {
+        out += value;
+        out += '\n';
+        return *this;
+    }
 
-        double totalValue = 0;
-        int totalItems = 0;
-        int lowStockItems = 0;
-        const int LOW_STOCK_THRESHOLD = 10;
+    ConsoleRenderer& number(long long value) {
+        appendPadded(out, value);
+        return *this;
+    }
 
-        cout << "\n" << string(80, '=') << endl;
-        cout << "                        STOCK REPORT" << endl;
-        cout << string(80, '=') << endl;
+    ConsoleRenderer& money(const MoneyTotal& value) {
+        appendMoney(out, value);
+        return *this;
+    }
 
-        // Category-wise breakdown
-        vector<string> categories = {"Electronics", "Food", "Medicine"};
-        for (const string& category : categories) {
-            vector<Product*> categoryProducts = getProductsByCategory(category);
-            if (!categoryProducts.empty()) {
-                cout << "\n" << category << " Category:\n";
-                cout << string(30, '-') << endl;
-                int categoryItems = 0;
-                double categoryValue = 0;
-                
-                for (const auto& product : categoryProducts) {
-                    categoryItems += product->getQuantity();
-                    categoryValue += product->getTotalValue();
-                }
-                
-                cout << "Items: " << categoryItems << " | Value: $" 
-                     << fixed << setprecision(2) << categoryValue << endl;
-            }
-        }
+    // A line of width copies of c
+    ConsoleRenderer& rule(char c, size_t width) {
+        out.append(width, c);
+        out += '\n';
+        return *this;
+    }
 
-        cout << "\nLow Stock Alert (Quantity < " << LOW_STOCK_THRESHOLD << "):\n";
-        cout << string(50, '-') << endl;
-        
-        for (const auto& product : inventory) {
-            totalValue += product->getTotalValue();
-            totalItems += product->getQuantity();
-            
-            if (product->getQuantity() < LOW_STOCK_THRESHOLD) {
-                cout << "- " << product->getName() 
-                     << " (ID: " << product->getProductId() 
-                     << ") - Stock: " << product->getQuantity() 
-                     << " [" << product->getCategory() << "]" << endl;
-                lowStockItems++;
-            }
+    // Column headings of a product table; full tables also head the
+    // type-specific columns
+    ConsoleRenderer& productHeader(bool typeColumns) {
+        appendPadded(out, "ID", 12);
+        appendPadded(out, "Name", 20);
+        appendPadded(out, "Category", 12);
+        appendPadded(out, "Price", 10);
+        appendPadded(out, "Stock", 8);
+        if (typeColumns) {
+            appendPadded(out, "Extra Info", 15);
+            appendPadded(out, "Details", 12);
         }
+        out += '\n';
+        return *this;
+    }
 
-        if (lowStockItems == 0) {
-            cout << "No items with low stock!\n";
-        }
+    ConsoleRenderer& product(const Product& product) {
+        product.appendDetails(out);
+        return *this;
+    }
 
-        cout << "\nOverall Summary:\n";
-        cout << string(30, '-') << endl;
-        cout << "Total Products: " << inventory.size() << endl;
-        cout << "Total Items in Stock: " << totalItems << endl;
-        cout << "Total Inventory Value: $" << fixed << setprecision(2) << totalValue << endl;
-        cout << "Low Stock Items: " << lowStockItems << endl;
-        cout << string(80, '=') << endl;
+    // Title block and headings of a full product table, 100 columns wide
+    ConsoleRenderer& tableStart(string_view title) {
+        line().rule('=', 100).line(title).rule('=', 100);
+        return productHeader(true).rule('-', 100);
     }
 
-    // Search products by name (partial match)
-    void searchByName(const string& searchTerm) const {
-        vector<Product*> results;
-        
-        for (const auto& product : inventory) {
-            string productName = product->getName();
-            string searchTermLower = searchTerm;
-            
-            // Convert to lowercase for case-insensitive search
-            transform(productName.begin(), productName.end(), productName.begin(), ::tolower);
-            transform(searchTermLower.begin(), searchTermLower.end(), searchTermLower.begin(), ::tolower);
-            
-            if (productName.find(searchTermLower) != string::npos) {
-                results.push_back(product.get());
-            }
-        }
+    // One product under the short column headings
+    ConsoleRenderer& productCard(string_view title, const Product& product) {
+        return line().line(title).productHeader(false).rule('-', 70).product(product);
+    }
 
+    ConsoleRenderer& searchResults(string_view term, const vector<Product*>& results) {
         if (results.empty()) {
-            cout << "No products found matching '" << searchTerm << "'\n";
-            return;
+            return text("No products found matching '").text(term).line("'");
         }
+        line().text("Search Results for '").text(term).line("':");
+        rule('-', 80).productHeader(false).rule('-', 80);
+        for (const Product* product : results) this->product(*product);
+        return *this;
+    }
 
-        cout << "\nSearch Results for '" << searchTerm << "':\n";
-        cout << string(80, '-') << endl;
-        cout << left << setw(12) << "ID" << setw(20) << "Name" 
-             << setw(12) << "Category" << setw(10) << "Price" 
-             << setw(8) << "Stock" << endl;
-        cout << string(80, '-') << endl;
+    ConsoleRenderer& stockReport(const StockReport& report) {
+        const StockSummary& summary = report.summary;
+        line().rule('=', 80).line("                        STOCK REPORT").rule('=', 80);
 
-        for (Product* product : results) {
-            product->displayDetails();
+        // Category-wise breakdown
+        for (CategoryId c = 0; c < CategoryRegistry::BUILT_IN; c++) {
+            if (summary.categories[c].products > 0) {
+                line().text(CategoryRegistry::name(c)).line(" Category:").rule('-', 30);
+                text("Items: ").number(summary.categories[c].items).text(" | Value: $");
+                money(summary.categories[c].value).line();
+            }
         }
-    }
 
-    // Remove product
-    void removeProduct(const string& id) {
-        auto it = find_if(inventory.begin(), inventory.end(),
-            [&id](const unique_ptr<Product>& p) {
-                return p->getProductId() == id;
-            });
-
-        if (it != inventory.end()) {
-            cout << "Product '" << (*it)->getName() << "' removed successfully!\n";
-            inventory.erase(it);
-        } else {
-            cout << "Product with ID " << id << " not found!\n";
+        line().text("Low Stock Alert (Quantity < ").number(InventoryManager::LOW_STOCK_THRESHOLD).line("):");
+        rule('-', 50);
+        for (const Product* product : report.lowStock) {
+            text("- ").text(product->getName()).text(" (ID: ").text(product->getProductId());
+            text(") - Stock: ").number(product->getQuantity()).text(" [").text(product->getCategory()).line("]");
+        }
+        if (report.lowStock.empty()) {
+            line("No items with low stock!");
         }
-    }
 
-    // Save inventory to category-specific CSV files
-    void saveToFiles() const {
-        saveCategoryToFile("Electronics", "electronics_inventory.csv");
-        saveCategoryToFile("Food", "food_inventory.csv");
-        saveCategoryToFile("Medicine", "medicine_inventory.csv");
-        
-        cout << "Data saved to category-specific CSV files successfully!\n";
-        cout << "Files created:\n";
-        cout << "- electronics_inventory.csv\n";
-        cout << "- food_inventory.csv\n";
-        cout << "- medicine_inventory.csv\n";
+        line().line("Overall Summary:").rule('-', 30);
+        text("Total Products: ").number(summary.overall.products).line();
+        text("Total Items in Stock: ").number(summary.overall.items).line();
+        text("Total Inventory Value: $").money(summary.overall.value).line();
+        text("Low Stock Items: ").number(report.lowStock.size()).line();
+        return rule('=', 80);
     }
 
-    // Load inventory from category-specific CSV files
-    void loadFromFiles() {
-        inventory.clear();
-        
-        loadCategoryFromFile("electronics_inventory.csv", "Electronics");
-        loadCategoryFromFile("food_inventory.csv", "Food");
-        loadCategoryFromFile("medicine_inventory.csv", "Medicine");
-        
-        cout << "Loaded " << inventory.size() << " products from category-specific CSV files.\n";
+    ConsoleRenderer& expiring(int days, const vector<Product*>& products) {
+        if (products.empty()) {
+            return text("No stock expires within ").number(days).line(" day(s)!");
+        }
+        tableStart("          STOCK EXPIRING WITHIN " + to_string(days) + " DAY(S)");
+        for (const Product* product : products) this->product(*product);
+        return rule('=', 100);
     }
 
-    // Export specific category to CSV
-    void exportCategoryToCsv(const string& category, const string& exportFilename) const {
-        vector<Product*> categoryProducts = getProductsByCategory(category);
-        
-        if (categoryProducts.empty()) {
-            cout << "No products found in " << category << " category!\n";
-            return;
+    ConsoleRenderer& pulledStock(const vector<PulledStock>& pulled) {
+        if (pulled.empty()) {
+            return line("No expired stock to pull!");
         }
-
-        ofstream file(exportFilename);
-        if (!file.is_open()) {
-            cout << "Error: Could not create export file!\n";
-            return;
+        line().line("Expired Stock Pulled:").rule('-', 50);
+        for (const PulledStock& entry : pulled) {
+            text("- ").text(entry.product->getName()).text(" (ID: ").text(entry.product->getProductId());
+            text(") - Pulled: ").number(entry.units).text(" [").text(entry.product->getCategory()).line("]");
         }
+        return *this;
+    }
 
-        // Write CSV header
-        file << categoryProducts[0]->getCsvHeader() << endl;
-
-        // Write data rows
-        for (const auto& product : categoryProducts) {
-            vector<string> row = product->toCsvRow();
-            file << joinCsvRow(row) << endl;
+    // Calls and latencies per operation, in microseconds
+    ConsoleRenderer& operationStats(const OperationStatsSnapshot& stats) {
+        line().rule('=', 80).line("                        OPERATION STATISTICS").rule('=', 80);
+        appendPadded(out, "Operation", 14);
+        appendPadded(out, "Calls", 12);
+        appendPadded(out, "Mean us", 12);
+        appendPadded(out, "p50 us", 12);
+        appendPadded(out, "p99 us", 12);
+        appendPadded(out, "Max us", 12);
+        out += '\n';
+        rule('-', 80);
+        for (size_t op = 0; op < size_t(StatOp::COUNT); op++) {
+            const LatencyHistogram& histogram = stats.operations[op];
+            appendPadded(out, statOpName(StatOp(op)), 14);
+            appendPadded(out, static_cast<long long>(histogram.calls), 12);
+            appendFixed(out, histogram.meanNanos() / 1000.0, 12);
+            appendFixed(out, histogram.percentile(0.50) / 1000.0, 12);
+            appendFixed(out, histogram.percentile(0.99) / 1000.0, 12);
+            appendFixed(out, histogram.maxNanos / 1000.0, 12);
+            out += '\n';
         }
-        file.close();
-        cout << category << " inventory exported to " << exportFilename << " successfully!\n";
+        return rule('=', 80);
     }
 
-    // Get available categories
-    vector<string> getAvailableCategories() const {
-        vector<string> categories;
-        for (const auto& product : inventory) {
-            string category = product->getCategory();
-            if (find(categories.begin(), categories.end(), category) == categories.end()) {
-                categories.push_back(category);
-            }
-        }
-        return categories;
+    ConsoleRenderer& messages(const vector<string>& lines) {
+        for (const string& message : lines) line(message);
+        return *this;
+    }
+
+    size_t size() const { return out.size(); }
+
+    // Write the screen to cout and start a new one
+    void write() {
+        cout.write(out.data(), out.size());
+        out.clear();
     }
 };
 
-// Main application class
+// Main application class: the console frontend. It reads input, calls the
+// manager and renders what comes back; the manager never prints.
 class InventoryApp {
 private:
+    // Where the Operation Statistics menu entry writes its JSON copy
+    static constexpr const char* STATS_FILE = "inventory_stats.json";
+
     InventoryManager manager;
 
     void displayMenu() const {
-        cout << "\n" << string(60, '=') << endl;
-        cout << "         INVENTORY MANAGEMENT SYSTEM" << endl;
-        cout << "           (Category-Specific CSVs)" << endl;
-        cout << string(60, '=') << endl;
-        cout << "1. Add Electronic Product\n";
-        cout << "2. Add Food Product\n";
-        cout << "3. Add Medicine Product\n";
-        cout << "4. Display All Products\n";
-        cout << "5. Display Products by Category\n";
-        cout << "6. Search Product by ID\n";
-        cout << "7. Search Product by Name\n";
-        cout << "8. Update Product\n";
-        cout << "9. Remove Product\n";
-        cout << "10. Generate Stock Report\n";
-        cout << "11. Export Category to CSV\n";
-        cout << "12. Save and Exit\n";
-        cout << string(60, '-') << endl;
-        cout << "Enter your choice: ";
+        ConsoleRenderer screen;
+        screen.line().rule('=', 60);
+        screen.line("         INVENTORY MANAGEMENT SYSTEM");
+        screen.line("           (Category-Specific CSVs)");
+        screen.rule('=', 60);
+        screen.text("1. Add Electronic Product\n"
+                    "2. Add Food Product\n"
+                    "3. Add Medicine Product\n"
+                    "4. Display All Products\n"
+                    "5. Display Products by Category\n"
+                    "6. Search Product by ID\n"
+                    "7. Search Product by Name\n"
+                    "8. Update Product\n"
+                    "9. Remove Product\n"
+                    "10. Generate Stock Report\n"
+                    "11. Export Category to CSV\n"
+                    "12. Save and Exit\n"
+                    "13. Operation Statistics\n");
+        screen.rule('-', 60);
+        screen.text("Enter your choice: ");
+        screen.write();
+    }
+
+    // Print what the manager noted (load problems, I/O errors), then the
+    // outcome of the operation that caused it
+    void showOutcome(string_view outcome) {
+        ConsoleRenderer screen;
+        screen.messages(manager.takeMessages());
+        if (!outcome.empty()) screen.line(outcome);
+        screen.write();
+    }
+
+    // Outcome of a change that was made but could not be logged
+    static constexpr const char* UNLOGGED_CHANGE =
+        "Error: Could not write the change to inventory_changes.log! It is kept only if the inventory is saved.";
+
+    // A price typed in dollars; -1, which every operation rejects, if it
+    // does not parse
+    static Cents readPrice() {
+        string text;
+        cin >> text;
+        Cents price;
+        return parsePriceField(text, price) ? price : -1;
+    }
+
+    void addProduct(ProductPtr product) {
+        string id(product->getProductId());
+        OpStatus status = manager.addProduct(move(product));
+        if (status == OpStatus::DuplicateId) {
+            showOutcome("Product with ID " + id + " already exists! Use update function instead.");
+        } else if (status == OpStatus::InvalidPrice) {
+            showOutcome("Invalid price! The product was not added.");
+        } else if (status == OpStatus::IoError) {
+            showOutcome(UNLOGGED_CHANGE);
+        } else {
+            showOutcome("Product added successfully!");
+        }
     }
 
     void addElectronicProduct() {
         string id, name, brand;
-        double price;
+        Cents price;
         int quantity, warranty;
 
         cout << "\nEnter Electronic Product Details:\n";
@@ -711,7 +5270,7 @@ private:
         cin.ignore();
         getline(cin, name);
         cout << "Price: ";
-        cin >> price;
+        price = readPrice();
         cout << "Quantity: ";
         cin >> quantity;
         cout << "Brand: ";
@@ -720,12 +5279,12 @@ private:
         cout << "Warranty (months): ";
         cin >> warranty;
 
-        manager.addProduct(make_unique<Electronic>(id, name, price, quantity, brand, warranty));
+        addProduct(make_unique<Electronic>(id, name, price, quantity, brand, warranty));
     }
 
     void addFoodProduct() {
         string id, name, expiry;
-        double price;
+        Cents price;
         int quantity;
         char organicChoice;
 
@@ -736,7 +5295,7 @@ private:
         cin.ignore();
         getline(cin, name);
         cout << "Price: ";
-        cin >> price;
+        price = readPrice();
         cout << "Quantity: ";
         cin >> quantity;
         cout << "Expiry Date (DD/MM/YYYY): ";
@@ -745,12 +5304,12 @@ private:
         cin >> organicChoice;
 
         bool isOrganic = (organicChoice == 'y' || organicChoice == 'Y');
-        manager.addProduct(make_unique<Food>(id, name, price, quantity, expiry, isOrganic));
+        addProduct(make_unique<Food>(id, name, price, quantity, expiry, isOrganic));
     }
 
     void addMedicineProduct() {
         string id, name, manufacturer, expiry;
-        double price;
+        Cents price;
         int quantity;
         char prescriptionChoice;
 
@@ -761,7 +5320,7 @@ private:
         cin.ignore();
         getline(cin, name);
         cout << "Price: ";
-        cin >> price;
+        price = readPrice();
         cout << "Quantity: ";
         cin >> quantity;
         cout << "Manufacturer: ";
@@ -773,10 +5332,56 @@ private:
         cin >> prescriptionChoice;
 
         bool prescriptionRequired = (prescriptionChoice == 'y' || prescriptionChoice == 'Y');
-        manager.addProduct(make_unique<Medicine>(id, name, price, quantity, manufacturer, expiry, prescriptionRequired));
+        addProduct(make_unique<Medicine>(id, name, price, quantity, manufacturer, expiry, prescriptionRequired));
+    }
+
+    void renderAllProducts(ConsoleRenderer& screen) const {
+        if (manager.getProductCount() == 0) {
+            screen.line("No products in inventory!");
+            return;
+        }
+        screen.tableStart("                          INVENTORY REPORT");
+        manager.forEachProduct([&screen](const Product& product) { screen.product(product); });
+        screen.rule('=', 100);
+    }
+
+    void renderCategory(ConsoleRenderer& screen, string_view category) const {
+        CategoryId id;
+        vector<Product*> categoryProducts;
+        if (CategoryRegistry::find(category, id)) categoryProducts = manager.getProductsByCategory(id);
+
+        if (categoryProducts.empty()) {
+            screen.text("No products found in ").text(category).line(" category!");
+            return;
+        }
+        screen.tableStart("                    " + string(category) + " INVENTORY");
+        for (const Product* product : categoryProducts) {
+            screen.product(*product);
+        }
+        screen.rule('=', 100);
+    }
+
+    void renderStockReport(ConsoleRenderer& screen) const {
+        if (manager.getProductCount() == 0) {
+            screen.line("No products in inventory!");
+            return;
+        }
+        screen.stockReport(manager.stockReport());
+    }
+
+    void displayAllProducts() const {
+        ConsoleRenderer screen;
+        renderAllProducts(screen);
+        screen.write();
     }
 
-    void displayByCategory() {
+    void displayProductsByCategory(const string& category) const {
+        ConsoleRenderer screen;
+        renderCategory(screen, category);
+        screen.write();
+    }
+
+    void displayByCategory() const {
         cout << "\nSelect Category:\n";
         cout << "1. Electronics\n";
         cout << "2. Food\n";
@@ -788,19 +5393,134 @@ private:
         
         switch (choice) {
             case 1:
-                manager.displayProductsByCategory("Electronics");
+                displayProductsByCategory("Electronics");
                 break;
             case 2:
-                manager.displayProductsByCategory("Food");
+                displayProductsByCategory("Food");
                 break;
             case 3:
-                manager.displayProductsByCategory("Medicine");
+                displayProductsByCategory("Medicine");
+                break;
+            default:
+                cout << "Invalid choice!\n";
+        }
+    }
+
+    void searchById() {
+        string id;
+        cout << "Enter Product ID: ";
+        cin >> id;
+        const Product* product = manager.searchById(id);
+        if (!product) {
+            showOutcome("Product not found!");
+            return;
+        }
+
+        ConsoleRenderer screen;
+        screen.productCard("Product Found:", *product).write();
+    }
+
+    // Search products by name (partial match)
+    void searchByName() {
+        string searchTerm;
+        cout << "Enter product name to search: ";
+        cin.ignore();
+        getline(cin, searchTerm);
+        ConsoleRenderer screen;
+        screen.searchResults(searchTerm, manager.findByName(searchTerm)).write();
+    }
+
+    // Update product details
+    void updateProduct() {
+        string id;
+        cout << "Enter Product ID to update: ";
+        cin >> id;
+        const Product* product = manager.searchById(id);
+        if (!product) {
+            showOutcome("Product with ID " + id + " not found!");
+            return;
+        }
+
+        ConsoleRenderer screen;
+        screen.productCard("Current product details:", *product);
+        screen.line().line("What would you like to update?");
+        screen.text("1. Name\n2. Price\n3. Quantity\n4. Category\n");
+        screen.text("Enter choice: ");
+        screen.write();
+
+        int choice;
+        cin >> choice;
+        OpStatus status;
+        switch (choice) {
+            case 1: {
+                string newName;
+                cout << "Enter new name: ";
+                cin.ignore();
+                getline(cin, newName);
+                status = manager.renameProduct(id, newName);
+                break;
+            }
+            case 2: {
+                cout << "Enter new price: ";
+                status = manager.setPrice(id, readPrice());
+                break;
+            }
+            case 3: {
+                int newQuantity;
+                cout << "Enter new quantity: ";
+                cin >> newQuantity;
+                status = manager.setQuantity(id, newQuantity);
+                break;
+            }
+            case 4: {
+                string newCategory;
+                cout << "Enter new category: ";
+                cin.ignore();
+                getline(cin, newCategory);
+                status = manager.setCategory(id, newCategory);
                 break;
+            }
             default:
                 cout << "Invalid choice!\n";
+                return;
+        }
+        if (status == OpStatus::InvalidPrice) {
+            showOutcome("Invalid price! The product was not changed.");
+        } else if (status == OpStatus::IoError) {
+            showOutcome(UNLOGGED_CHANGE);
+        } else if (status == OpStatus::NotFound) {
+            showOutcome("Product with ID " + id + " not found!");
+        } else {
+            showOutcome("Product updated successfully!");
+        }
+    }
+
+    void removeProduct() {
+        string id;
+        cout << "Enter Product ID to remove: ";
+        cin >> id;
+        const Product* product = manager.searchById(id);
+        if (!product) {
+            showOutcome("Product with ID " + id + " not found!");
+            return;
+        }
+        string name(product->getName());
+        OpStatus status = manager.removeProduct(id);
+        if (status == OpStatus::IoError) {
+            showOutcome(UNLOGGED_CHANGE);
+        } else if (status == OpStatus::NotFound) {
+            showOutcome("Product with ID " + id + " not found!");
+        } else {
+            showOutcome("Product '" + name + "' removed successfully!");
         }
     }
 
+    void generateStockReport() const {
+        ConsoleRenderer screen;
+        renderStockReport(screen);
+        screen.write();
+    }
+
     void exportCategoryToCsv() {
         cout << "\nSelect Category to Export:\n";
         cout << "1. Electronics\n";
@@ -830,14 +5550,238 @@ private:
         string exportFilename;
         cout << "Enter export filename (with .csv extension): ";
         cin >> exportFilename;
-        manager.exportCategoryToCsv(category, exportFilename);
+        switch (manager.exportCategoryToCsv(category, exportFilename)) {
+            case OpStatus::Ok:
+                showOutcome(category + " inventory exported to " + exportFilename + " successfully!");
+                break;
+            case OpStatus::NotFound:
+                showOutcome("No products found in " + category + " category!");
+                break;
+            default:
+                showOutcome("Error: Could not create export file!");
+        }
+    }
+
+    void saveToFiles() {
+        if (!manager.saveToFiles()) {
+            showOutcome("");
+        } else if (manager.getSaveMode() == InventoryManager::SaveMode::ChangeLog) {
+            showOutcome("Changes saved to inventory_changes.log successfully!");
+        } else {
+            showOutcome("Data saved to category-specific CSV files successfully!\n"
+                        "Files created:\n"
+                        "- electronics_inventory.csv\n"
+                        "- food_inventory.csv\n"
+                        "- medicine_inventory.csv");
+        }
+    }
+
+    // Print the operation stats and write them to STATS_FILE as JSON
+    void showOperationStats() {
+        OperationStatsSnapshot stats = OperationStats::instance().snapshot();
+        ConsoleRenderer screen;
+        screen.operationStats(stats);
+        if (writeOperationStats(stats, STATS_FILE)) {
+            screen.text("Statistics written to ").line(STATS_FILE);
+        } else {
+            screen.text("Error: Could not write ").line(STATS_FILE);
+        }
+        screen.write();
+    }
+
+    static bool writeOperationStats(const OperationStatsSnapshot& stats, const string& filename) {
+        ofstream file(filename, ios::binary);
+        file << operationStatsJson(stats);
+        return bool(file);
+    }
+
+    // Why a command failed, for the command mode's error lines
+    static string describe(OpStatus status, string_view id) {
+        switch (status) {
+            case OpStatus::NotFound: return "Product with ID " + string(id) + " not found!";
+            case OpStatus::DuplicateId: return "Product with ID " + string(id) + " already exists!";
+            case OpStatus::StockOverflow: return "Stock of product " + string(id) + " would overflow!";
+            case OpStatus::InvalidPrice: return "Price must be a number from 0 to 21474836.47!";
+            case OpStatus::InvalidProduct: return "Invalid product!";
+            case OpStatus::IoError: return "Could not write the file!";
+            default: return "";
+        }
+    }
+
+    // Run one command of the command mode; false with error set if it failed
+    bool runCommand(const vector<string_view>& fields, ConsoleRenderer& screen, vector<string_view>& row,
+                    string& error) {
+        string_view command = fields[0];
+        size_t arguments = fields.size() - 1;
+        string_view id = arguments > 0 ? fields[1] : string_view();
+        OpStatus status = OpStatus::Ok;
+
+        if (command == "add" && arguments >= 2) {
+            row.assign(fields.begin() + 2, fields.end());
+            id = row[0];
+            status = manager.addProductFromCsv(fields[1], row, error);
+            if (status == OpStatus::InvalidProduct) return false;
+        } else if (command == "stock" && arguments == 2) {
+            int change;
+            if (!parseNumberField(fields[2], change)) {
+                error = "invalid stock change '" + string(fields[2]) + "'";
+                return false;
+            }
+            status = manager.updateStock(id, change);
+        } else if (command == "update" && arguments == 3) {
+            string_view field = fields[2], value = fields[3];
+            if (field == "name") {
+                status = manager.renameProduct(id, value);
+            } else if (field == "category") {
+                status = manager.setCategory(id, value);
+            } else if (field == "price") {
+                Cents price;
+                status = parsePriceField(value, price) ? manager.setPrice(id, price) : OpStatus::InvalidPrice;
+            } else if (field == "quantity") {
+                int quantity;
+                if (!parseNumberField(value, quantity)) {
+                    error = "invalid quantity '" + string(value) + "'";
+                    return false;
+                }
+                status = manager.setQuantity(id, quantity);
+            } else {
+                error = "unknown field '" + string(field) + "'";
+                return false;
+            }
+        } else if (command == "remove" && arguments == 1) {
+            status = manager.removeProduct(id);
+        } else if (command == "find" && arguments == 1) {
+            const Product* product = manager.searchById(id);
+            if (product) {
+                screen.productCard("Product Found:", *product);
+            } else {
+                status = OpStatus::NotFound;
+            }
+        } else if (command == "search" && arguments == 1) {
+            screen.searchResults(fields[1], manager.findByName(fields[1]));
+        } else if (command == "list" && arguments == 0) {
+            renderAllProducts(screen);
+        } else if (command == "list" && arguments == 1) {
+            renderCategory(screen, fields[1]);
+        } else if (command == "report" && arguments == 0) {
+            renderStockReport(screen);
+        } else if (command == "expiring" && arguments == 1) {
+            int days;
+            if (!parseNumberField(fields[1], days) || days < 0) {
+                error = "invalid number of days '" + string(fields[1]) + "'";
+                return false;
+            }
+            screen.expiring(days, manager.expiringWithin(days));
+        } else if (command == "pull-expired" && arguments == 0) {
+            PullResult result = manager.pullExpiredStock();
+            screen.pulledStock(result.pulled);
+            status = result.status;
+        } else if (command == "export" && (arguments == 2 || arguments == 4)) {
+            string category(fields[1]), filename(fields[2]);
+            if (arguments == 2) {
+                status = manager.exportCategoryToCsv(category, filename);
+            } else if (fields[3] == "below") {
+                int threshold;
+                if (!parseNumberField(fields[4], threshold)) {
+                    error = "invalid quantity '" + string(fields[4]) + "'";
+                    return false;
+                }
+                status = manager.exportCategoryToCsv(category, filename,
+                    [threshold](const Product& p) { return p.getQuantity() < threshold; });
+            } else if (fields[3] == "brand") {
+                string_view brand = fields[4];
+                status = manager.exportCategoryToCsv(category, filename, [brand](const Product& p) {
+                    return p.getProductType() == "Electronic" && static_cast<const Electronic&>(p).getBrand() == brand;
+                });
+            } else {
+                error = "unknown export filter '" + string(fields[3]) + "'";
+                return false;
+            }
+            if (status == OpStatus::NotFound) {
+                error = "No products found in " + string(fields[1]) + " category!";
+                return false;
+            }
+        } else if (command == "stats" && arguments == 0) {
+            screen.operationStats(OperationStats::instance().snapshot());
+        } else if (command == "stats" && arguments == 1) {
+            if (!writeOperationStats(OperationStats::instance().snapshot(), string(fields[1]))) {
+                status = OpStatus::IoError;
+            }
+        } else if (command == "save" && arguments == 0) {
+            if (!manager.saveToFiles()) status = OpStatus::IoError;
+        } else {
+            error = "unknown command '" + string(command) + "' with " + to_string(arguments) + " argument(s)";
+            return false;
+        }
+
+        if (status == OpStatus::Ok) return true;
+        error = describe(status, id);
+        return false;
     }
 
 public:
+    // Command mode: run one command per line of input and return the number
+    // that failed. Lines are CSV records (quote fields holding commas):
+    //   add,<Electronic|Food|Medicine>,<row as in that type's CSV file>
+    //   stock,<id>,<change>
+    //   update,<id>,<name|price|quantity|category>,<value>
+    //   remove,<id>
+    //   find,<id>   search,<name>   list[,<category>]   report
+    //   expiring,<days>   pull-expired   stats[,<file>]
+    //   export,<category>,<file>[,below,<quantity>|,brand,<brand>]    save
+    // Blank lines and lines starting with # are skipped. Only query results
+    // and failures are printed, from one buffer written in large blocks.
+    // Changes are synced to the change log in groups, each before any output
+    // after it is written; the inventory is saved at the end.
+    size_t runCommands(string_view input) {
+        static constexpr size_t SYNC_EVERY_COMMANDS = 1 << 16;
+        static constexpr size_t WRITE_BLOCK_BYTES = 1 << 20;
+
+        ConsoleRenderer screen;
+        screen.messages(manager.takeMessages());
+        CsvReader reader(input);
+        vector<string_view> row;
+        string error;
+        size_t commands = 0, failed = 0, unsynced = 0;
+        manager.setSyncDeferred(true);
+        while (reader.nextRecord()) {
+            const vector<string_view>& fields = reader.getFields();
+            string_view command = trimField(fields[0]);
+            if ((fields.size() == 1 && command.empty()) || (!command.empty() && command[0] == '#')) continue;
+
+            commands++;
+            if (reader.hasUnterminatedQuote()) {
+                error = "unterminated quoted field";
+            } else if (runCommand(fields, screen, row, error)) {
+                error.clear();
+            }
+            if (!error.empty()) {
+                failed++;
+                screen.text("line ").number(reader.getLineNumber()).text(": ").line(error);
+                error.clear();
+            }
+            screen.messages(manager.takeMessages());
+
+            if (++unsynced >= SYNC_EVERY_COMMANDS || screen.size() >= WRITE_BLOCK_BYTES) {
+                if (!manager.syncPendingChanges()) failed++;
+                screen.messages(manager.takeMessages());
+                screen.write();
+                unsynced = 0;
+            }
+        }
+        if (!manager.syncPendingChanges()) failed++;
+        manager.setSyncDeferred(false);
+        if (!manager.saveToFiles()) failed++;
+        screen.messages(manager.takeMessages());
+        screen.text("Processed ").number(commands).text(" command(s), ").number(failed).line(" failed.");
+        screen.write();
+        return failed;
+    }
+
     void run() {
         int choice;
         
-        cout << "Welcome to Category-Specific Inventory Management System!\n";
+        showOutcome("Welcome to Category-Specific Inventory Management System!");
         
         do {
             displayMenu();
@@ -854,61 +5798,37 @@ public:
                     addMedicineProduct();
                     break;
                 case 4:
-                    manager.displayAllProducts();
+                    displayAllProducts();
                     break;
                 case 5:
                     displayByCategory();
                     break;
-                case 6: {
-                    string id;
-                    cout << "Enter Product ID: ";
-                    cin >> id;
-                    Product* product = manager.searchById(id);
-                    if (product) {
-                        cout << "\nProduct Found:\n";
-                        cout << left << setw(12) << "ID" << setw(20) << "Name" 
-                             << setw(12) << "Category" << setw(10) << "Price" 
-                             << setw(8) << "Stock" << endl;
-                        cout << string(70, '-') << endl;
-                        product->displayDetails();
-                    } else {
-                        cout << "Product not found!\n";
-                    }
+                case 6:
+                    searchById();
                     break;
-                }
-                case 7: {
-                    string searchTerm;
-                    cout << "Enter product name to search: ";
-                    cin.ignore();
-                    getline(cin, searchTerm);
-                    manager.searchByName(searchTerm);
+                case 7:
+                    searchByName();
                     break;
-                }
-                case 8: {
-                    string id;
-                    cout << "Enter Product ID to update: ";
-                    cin >> id;
-                    manager.updateProduct(id);
+                case 8:
+                    updateProduct();
                     break;
-                }
-                case 9: {
-                    string id;
-                    cout << "Enter Product ID to remove: ";
-                    cin >> id;
-                    manager.removeProduct(id);
+                case 9:
+                    removeProduct();
                     break;
-                }
                 case 10:
-                    manager.generateStockReport();
+                    generateStockReport();
                     break;
                 case 11:
                     exportCategoryToCsv();
                     break;
                 case 12:
                     cout << "Saving data and exiting...\n";
-                    manager.saveToFiles();
+                    saveToFiles();
                     cout << "Thank you for using Category-Specific Inventory Management System!\n";
                     break;
+                case 13:
+                    showOperationStats();
+                    break;
                 default:
                     cout << "Invalid choice! Please try again.\n";
             }
@@ -916,9 +5836,71 @@ public:
     }
 };
 
+#ifndef IMS_NO_MAIN
+#if IMS_HAVE_EPOLL
+static InventoryServer* signalledServer = nullptr;
+
+static void stopServerOnSignal(int) {
+    if (signalledServer) signalledServer->stop();
+}
+
+// Serve the inventory until SIGINT or SIGTERM, then save it
+static int serve(const string& address) {
+    InventoryManager manager;
+    for (const string& message : manager.takeMessages()) cout << message << '\n';
+    InventoryServer server(manager);
+    string error;
+    if (!server.listen(address, error)) {
+        cerr << "Error: " << error << "\n";
+        return 2;
+    }
+    signalledServer = &server;
+    signal(SIGINT, stopServerOnSignal);
+    signal(SIGTERM, stopServerOnSignal);
+    cout << "Serving " << manager.getProductCount() << " products on " << address << endl;
+    server.run();
+    signalledServer = nullptr;
+
+    bool saved = manager.saveToFiles();
+    for (const string& message : manager.takeMessages()) cout << message << '\n';
+    return saved ? 0 : 1;
+}
+#endif
+
 // Main function
-int main() {
+//   ims                     interactive menu
+//   ims --batch [file | -]  run the commands in file (or stdin) and exit;
+//                           exit status 1 if any command failed
+//   ims --serve <address>   serve queries on a Unix socket path or a
+//                           loopback TCP port until interrupted
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        InventoryApp app;
+        app.run();
+        return 0;
+    }
+
+    string_view mode = argv[1];
+#if IMS_HAVE_EPOLL
+    if (mode == "--serve" && argc == 3) return serve(argv[2]);
+#endif
+    string source = (argc > 2) ? argv[2] : "-";
+    if (mode != "--batch" || argc > 3) {
+        cerr << "Usage: " << argv[0] << " [--batch [file | -] | --serve <socket path | port>]\n";
+        return 2;
+    }
+    MappedFile file;
+    string input;
+    if (source == "-") {
+        ostringstream buffer;
+        buffer << cin.rdbuf();
+        input = buffer.str();
+    } else if (!file.open(source)) {
+        cerr << "Error: Could not open " << source << "!\n";
+        return 2;
+    }
     InventoryApp app;
-    app.run();
-    return 0;
-}
\ No newline at end of file
+    size_t failed = app.runCommands(source == "-" ? string_view(input) : file.contents());
+    return failed > 0 ? 1 : 0;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,1597 @@
+// Performance benchmarks for the inventory engine in ims.cpp.
+//
+// Build: g++ -std=c++17 -O2 -pthread -o ims_bench ims_bench.cpp
+// Run:   ./ims_bench [rows] [benchmark] [--json results.json]
+//        ./ims_bench --generate <dir> [rows]
+//
+// Rows take a k or m suffix (10k, 1m, 10m). Scratch data is written under
+// the system temp directory, so the inventory CSVs next to the binary are
+// never touched. --json also writes every result line to a file for
+// regression tracking; --generate only writes the synthetic catalog.
+
+#define IMS_NO_MAIN
+#include "ims.cpp"
+
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <cmath>
+#include <deque>
+
+namespace fs = std::filesystem;
+using Clock = chrono::steady_clock;
+
+// Every global allocation is counted so benchmarks can report allocations
+// and bytes per operation
+static atomic<size_t> allocationCount{0};
+static atomic<size_t> allocationBytes{0};
+
+// Kept out of line so the compiler does not pair the malloc/free inside
+// with individual new/delete expressions
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    allocationBytes.fetch_add(size, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new(size_t size, align_val_t align) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    allocationBytes.fetch_add(size, memory_order_relaxed);
+    size_t alignment = static_cast<size_t>(align);
+    if (void* p = aligned_alloc(alignment, (max<size_t>(size, 1) + alignment - 1) / alignment * alignment)) return p;
+    throw bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, align_val_t) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t, align_val_t) noexcept { free(p); }
+
+static double secondsSince(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Every result of the run, for --json. Timed results carry items and
+// seconds; the rest a single value in unit.
+struct BenchRecord {
+    string benchmark;
+    string name;
+    size_t items = 0;
+    double seconds = 0;
+    string unit;
+    double value = 0;
+};
+
+static vector<BenchRecord> benchRecords;
+static string currentBenchmark;
+
+static void recordValue(const string& name, const string& unit, double value) {
+    BenchRecord record;
+    record.benchmark = currentBenchmark;
+    record.name = name;
+    record.unit = unit;
+    record.value = value;
+    benchRecords.push_back(move(record));
+}
+
+static void printResult(const string& name, size_t items, double seconds) {
+    BenchRecord record;
+    record.benchmark = currentBenchmark;
+    record.name = name;
+    record.items = items;
+    record.seconds = seconds;
+    benchRecords.push_back(move(record));
+    cout << left << setw(36) << name
+         << right << setw(12) << items << " items"
+         << setw(12) << fixed << setprecision(2) << seconds * 1000.0 << " ms"
+         << setw(16) << setprecision(0) << (seconds > 0 ? items / seconds : 0.0) << " items/s\n";
+}
+
+// Deterministic electronics catalog; every 16th name needs CSV quoting
+static void writeElectronicsCsv(const fs::path& path, size_t rows, unsigned seed = 42) {
+    static const char* brands[] = {"Dell", "HP", "Boat", "Lenovo", "Acme, Inc.", "Sony"};
+    static const char* items[] = {"Laptop", "Keyboard", "USB Cable", "Mouse", "Monitor", "Charger"};
+    mt19937 rng(seed);
+    string out = "product_id,name,price,quantity,brand,warranty_months\n";
+    for (size_t i = 0; i < rows; i++) {
+        string name = string(items[rng() % 6]) + " " + to_string(rng() % 1000);
+        if (i % 16 == 0) name += " 15\" \"Pro\"";
+        out += "E" + to_string(i) + "," + Product::escapeCsv(name) + ","
+             + to_string((rng() % 100000) / 100.0) + "," + to_string(rng() % 200) + ","
+             + Product::escapeCsv(brands[rng() % 6]) + "," + to_string(rng() % 36) + "\n";
+    }
+    ofstream file(path, ios::binary);
+    file << out;
+}
+
+static void writeFoodCsv(const fs::path& path, size_t rows, unsigned seed = 43) {
+    static const char* items[] = {"Apples", "Bread", "Chocolates", "Rice", "Milk, 1L", "Eggs"};
+    mt19937 rng(seed);
+    string out = "product_id,name,price,quantity,expiry_date,is_organic\n";
+    for (size_t i = 0; i < rows; i++) {
+        char expiry[16];
+        snprintf(expiry, sizeof(expiry), "%02u/%02u/%u", unsigned(1 + rng() % 28),
+                 unsigned(1 + rng() % 12), unsigned(2025 + rng() % 3));
+        out += "F" + to_string(i) + "," + Product::escapeCsv(string(items[rng() % 6]) + " " + to_string(rng() % 1000))
+             + "," + to_string((rng() % 5000) / 100.0) + "," + to_string(rng() % 200) + ","
+             + expiry + "," + (rng() % 2 ? "1" : "0") + "\n";
+    }
+    ofstream file(path, ios::binary);
+    file << out;
+}
+
+static void writeMedicineCsv(const fs::path& path, size_t rows, unsigned seed = 44) {
+    static const char* items[] = {"Paracetamol", "Vitamin A Tablets", "Antibiotics", "Cough Syrup"};
+    static const char* makers[] = {"Mankind", "Cipla", "Sun Pharma", "Dr. Reddy's"};
+    mt19937 rng(seed);
+    string out = "product_id,name,price,quantity,manufacturer,expiry_date,prescription_required\n";
+    for (size_t i = 0; i < rows; i++) {
+        char expiry[16];
+        snprintf(expiry, sizeof(expiry), "%02u/%02u/%u", unsigned(1 + rng() % 28),
+                 unsigned(1 + rng() % 12), unsigned(2025 + rng() % 3));
+        out += "M" + to_string(i) + "," + items[rng() % 4] + string(" ") + to_string(rng() % 500) + ","
+             + to_string((rng() % 3000) / 100.0) + "," + to_string(rng() % 200) + ","
+             + Product::escapeCsv(makers[rng() % 4]) + "," + expiry + "," + (rng() % 2 ? "1" : "0") + "\n";
+    }
+    ofstream file(path, ios::binary);
+    file << out;
+}
+
+// Write all three category files the InventoryManager loads from dir
+static void writeCatalog(const fs::path& dir, size_t rows) {
+    writeElectronicsCsv(dir / "electronics_inventory.csv", rows / 2);
+    writeFoodCsv(dir / "food_inventory.csv", rows / 4);
+    writeMedicineCsv(dir / "medicine_inventory.csv", rows - rows / 2 - rows / 4);
+}
+
+// Reference copy of the original getline/stringstream loader
+static vector<string> legacyParseCsvLine(const string& line) {
+    vector<string> tokens;
+    stringstream ss(line);
+    bool inQuotes = false;
+    string currentToken;
+    for (size_t i = 0; i < line.length(); i++) {
+        char c = line[i];
+        if (c == '"') {
+            if (inQuotes && i + 1 < line.length() && line[i + 1] == '"') {
+                currentToken += '"';
+                i++;
+            } else {
+                inQuotes = !inQuotes;
+            }
+        } else if (c == ',' && !inQuotes) {
+            tokens.push_back(currentToken);
+            currentToken.clear();
+        } else {
+            currentToken += c;
+        }
+    }
+    tokens.push_back(currentToken);
+    return tokens;
+}
+
+static size_t legacyLoadElectronics(const fs::path& path, vector<unique_ptr<Product>>& out) {
+    ifstream file(path);
+    string line;
+    bool isFirstLine = true;
+    while (getline(file, line)) {
+        if (line.empty()) continue;
+        if (isFirstLine) {
+            isFirstLine = false;
+            continue;
+        }
+        vector<string> tokens = legacyParseCsvLine(line);
+        if (tokens.size() < 6) continue;
+        try {
+            out.push_back(make_unique<Electronic>(tokens[0], tokens[1], llround(stod(tokens[2]) * 100),
+                                                  stoi(tokens[3]), tokens[4], stoi(tokens[5])));
+        } catch (const exception&) {
+        }
+    }
+    return out.size();
+}
+
+static void benchCsvLoad(const fs::path& dir, size_t rows) {
+    fs::path path = dir / "electronics_bench.csv";
+    writeElectronicsCsv(path, rows);
+    cout << "\nCSV load (" << rows << " rows, " << fs::file_size(path) / (1024 * 1024) << " MiB)\n";
+
+    {
+        vector<unique_ptr<Product>> products;
+        auto start = Clock::now();
+        size_t loaded = legacyLoadElectronics(path, products);
+        printResult("legacy getline loader", loaded, secondsSince(start));
+    }
+    {
+        vector<ProductPtr> products;
+        CsvLoadReport report;
+        auto start = Clock::now();
+        MappedFile file;
+        file.open(path.string());
+        ProductArena arena(file.contents().size());
+        InventoryManager::parseCategoryRows(file.contents(), CategoryRegistry::ELECTRONICS, arena, report,
+            [&products](ProductPtr& product) {
+                products.push_back(move(product));
+                return true;
+            });
+        printResult("mmap zero-copy loader", report.rowsLoaded, secondsSince(start));
+    }
+}
+
+// InventoryManager loads and saves relative to the working directory; run
+// it inside dir
+template <typename Body>
+static void inDataDirectory(const fs::path& dir, Body&& body) {
+    fs::path previous = fs::current_path();
+    fs::current_path(dir);
+    body();
+    fs::current_path(previous);
+}
+
+// Electronics rows that stress chunk splitting: quoted names spanning lines,
+// escaped quotes, CRLF line ends and malformed rows
+static void writeAwkwardElectronicsCsv(const fs::path& path, size_t rows) {
+    mt19937 rng(46);
+    string out = "product_id,name,price,quantity,brand,warranty_months\r\n";
+    for (size_t i = 0; i < rows; i++) {
+        string n = to_string(rng() % 1000);
+        string price = i % 7 == 1 ? "not a price" : to_string(rng() % 100000 / 100.0);
+        string name = i % 7 == 0 ? "\"Cable\r\nwith, newline " + n + "\""
+                    : i % 7 == 2 ? "\"Monitor \"\"" + n + "\"\" inch\""
+                    : "Mouse " + n;
+        out += "E" + to_string(i) + "," + name + "," + price + "," + to_string(rng() % 200) + ",Acme,12";
+        out += i % 3 == 0 ? "\r\n" : "\n";
+    }
+    ofstream file(path, ios::binary);
+    file << out;
+}
+
+// Every product's category and CSV row in inventory order, then what the
+// load reported
+static string inventoryFingerprint(InventoryManager& manager) {
+    string out;
+    manager.forEachProduct([&out](const Product& product) {
+        out += product.getCategory();
+        out += ':';
+        product.toCsvRow(out);
+        out += '\n';
+    });
+    for (const string& message : manager.takeMessages()) out += message + '\n';
+    return out;
+}
+
+// The parallel load must build exactly the inventory the serial one does,
+// whatever the thread count; false after reporting the first difference
+static bool parallelLoadMatches(const string& what, const vector<unsigned>& threadCounts) {
+    InventoryManager manager;
+    manager.takeMessages();
+    manager.loadFromFiles();
+    string expected = inventoryFingerprint(manager);
+    for (unsigned threads : threadCounts) {
+        manager.loadFromFilesParallel(threads);
+        if (inventoryFingerprint(manager) != expected) {
+            cerr << "  " << what << ": parallel load with " << threads << " threads differs from the serial load\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static void benchParallelLoad(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    cout << "\nInventory load, three category files (" << rows << " rows, " << threads << " threads)\n";
+
+    double serial = 0, parallel = 0;
+    size_t loaded = 0;
+    bool identical = true;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        auto start = Clock::now();
+        manager.loadFromFiles();
+        serial = secondsSince(start);
+        start = Clock::now();
+        manager.loadFromFilesParallel(threads);
+        parallel = secondsSince(start);
+        loaded = manager.getProductCount();
+        identical = parallelLoadMatches("catalog", {1, 2, 3, 4, 8, threads});
+    });
+    printResult("loadFromFiles (serial)", loaded, serial);
+    printResult("loadFromFilesParallel", loaded, parallel);
+
+    fs::path awkward = dir / "awkward";
+    fs::create_directories(awkward);
+    writeAwkwardElectronicsCsv(awkward / "electronics_inventory.csv", max<size_t>(rows / 10, 200000));
+    inDataDirectory(awkward, [&]() {
+        identical = parallelLoadMatches("multi-line, CRLF and bad rows", {1, 2, 3, 4, 8, threads}) && identical;
+    });
+    fs::remove_all(awkward);
+    if (!identical) {
+        cerr << "Parallel load check failed\n";
+        exit(1);
+    }
+    cout << "  parallel loads match the serial load at 1, 2, 3, 4, 8 and " << threads << " threads\n";
+}
+
+// Reference copy of the original report arithmetic: one filtering pass per
+// category plus a pass for the totals and low-stock list
+template <typename Products>
+static double legacyReportTotals(const Products& inventory) {
+    double checksum = 0;
+    for (const string category : {"Electronics", "Food", "Medicine"}) {
+        vector<Product*> categoryProducts;
+        for (const auto& product : inventory) {
+            if (product->getCategory() == category) categoryProducts.push_back(product.get());
+        }
+        int categoryItems = 0;
+        double categoryValue = 0;
+        for (const auto& product : categoryProducts) {
+            categoryItems += product->getQuantity();
+            categoryValue += product->getTotalValue();
+        }
+        checksum += categoryItems + categoryValue;
+    }
+    int lowStockItems = 0;
+    for (const auto& product : inventory) {
+        checksum += product->getTotalValue() + product->getQuantity();
+        if (product->getQuantity() < InventoryManager::LOW_STOCK_THRESHOLD) lowStockItems++;
+    }
+    return checksum + lowStockItems;
+}
+
+// Products parsed from the catalog files, with the arenas that own them
+struct LoadedCatalog {
+    vector<unique_ptr<ProductArena>> arenas;
+    vector<ProductPtr> products;
+};
+
+static LoadedCatalog loadCatalogProducts(const fs::path& dir) {
+    LoadedCatalog catalog;
+    const pair<const char*, CategoryId> files[] = {{"electronics_inventory.csv", CategoryRegistry::ELECTRONICS},
+                                                   {"food_inventory.csv", CategoryRegistry::FOOD},
+                                                   {"medicine_inventory.csv", CategoryRegistry::MEDICINE}};
+    for (const auto& file : files) {
+        MappedFile mapped;
+        mapped.open((dir / file.first).string());
+        CsvLoadReport report;
+        catalog.arenas.push_back(make_unique<ProductArena>(mapped.contents().size()));
+        InventoryManager::parseCategoryRows(mapped.contents(), file.second, *catalog.arenas.back(), report,
+            [&catalog](ProductPtr& product) {
+                catalog.products.push_back(move(product));
+                return true;
+            });
+    }
+    return catalog;
+}
+
+template <typename Kernel>
+static StockSummary timeKernel(const string& name, const ColumnarInventory& columns, Kernel kernel) {
+    StockSummary summary;
+    summary.categories.resize(columns.categoryNames.size());
+    auto start = Clock::now();
+    kernel(columns.prices.data(), columns.quantities.data(), columns.categoryIds.data(), columns.size(),
+           InventoryManager::LOW_STOCK_THRESHOLD, summary.categories);
+    printResult(name, columns.size(), secondsSince(start));
+    return summary;
+}
+
+static void benchStockReport(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nStock report (" << rows << " products)\n";
+
+    LoadedCatalog catalog = loadCatalogProducts(dir);
+    auto start = Clock::now();
+    volatile double checksum = legacyReportTotals(catalog.products);
+    (void)checksum;
+    printResult("legacy three-pass report", catalog.products.size(), secondsSince(start));
+    catalog = LoadedCatalog();
+
+    double report = 0;
+    ColumnarInventory columns;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        auto reportStart = Clock::now();
+        volatile size_t lowStock = manager.recomputeStockReport().lowStock.size();
+        (void)lowStock;
+        report = secondsSince(reportStart);
+        columns = manager.buildColumnarStore();
+    });
+    printResult("recomputeStockReport (single pass)", rows, report);
+    StockSummary scalar = timeKernel("scalar kernel (columnar)", columns, aggregateStockScalar);
+#if IMS_HAVE_AVX2
+    if (cpuSupportsAvx2()) {
+        StockSummary simd = timeKernel("AVX2 kernel (columnar)", columns, aggregateStockAvx2);
+        for (size_t c = 0; c < simd.categories.size(); c++) {
+            const CategoryTotals& a = scalar.categories[c];
+            const CategoryTotals& b = simd.categories[c];
+            if (a.products != b.products || a.items != b.items || a.lowStock != b.lowStock ||
+                !(a.value == b.value)) {
+                cout << "  AVX2 kernel disagrees with scalar kernel for category " << c << "\n";
+            }
+        }
+    }
+#endif
+
+    // Analytics-scale scan straight on synthetic columns
+    size_t bigRows = rows * 10;
+    ColumnarInventory big;
+    big.reserve(bigRows);
+    uint8_t categories[] = {big.categoryId("Electronics"), big.categoryId("Food"), big.categoryId("Medicine")};
+    mt19937 rng(45);
+    for (size_t i = 0; i < bigRows; i++) {
+        big.append("P" + to_string(i), "Item", Cents(rng() % 100000),
+                   static_cast<int32_t>(rng() % 200), categories[i % 3], NO_EXPIRY);
+    }
+    timeKernel("scalar kernel (synthetic columns)", big, aggregateStockScalar);
+#if IMS_HAVE_AVX2
+    if (cpuSupportsAvx2()) timeKernel("AVX2 kernel (synthetic columns)", big, aggregateStockAvx2);
+#endif
+}
+
+// Reference copy of the original save row formatting: a vector<string> of
+// to_string()/escapeCsv() fields per row, joined and written with endl
+static void legacySaveRows(const vector<ProductPtr>& products, ostream& out) {
+    for (const auto& product : products) {
+        vector<string> row = {string(product->getProductId()), Product::escapeCsv(product->getName()),
+                              to_string(product->getPrice() / 100.0), to_string(product->getQuantity())};
+        string line;
+        for (size_t i = 0; i < row.size(); i++) {
+            if (i > 0) line += ",";
+            line += row[i];
+        }
+        out << line << endl;
+    }
+}
+
+static void printAllocations(const string& name, size_t items, size_t allocations) {
+    recordValue(name, "allocations", double(allocations));
+    cout << left << setw(36) << name << right << setw(12) << allocations << " allocations"
+         << setw(12) << fixed << setprecision(2) << (items ? double(allocations) / items : 0.0) << " per product\n";
+}
+
+static void benchAllocations(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nHeap allocations (" << rows << " products)\n";
+
+    {
+        LoadedCatalog catalog = loadCatalogProducts(dir);
+        ofstream sink(dir / "legacy_rows.csv");
+        size_t before = allocationCount.load();
+        legacySaveRows(catalog.products, sink);
+        printAllocations("legacy row formatting", catalog.products.size(), allocationCount.load() - before);
+    }
+
+    size_t load = 0, save = 0, report = 0;
+    inDataDirectory(dir, [&]() {
+        size_t before = allocationCount.load();
+        InventoryManager manager;
+        load = allocationCount.load() - before;
+
+        before = allocationCount.load();
+        manager.exportCategoryToCsv("Electronics", "electronics_inventory.csv");
+        manager.exportCategoryToCsv("Food", "food_inventory.csv");
+        manager.exportCategoryToCsv("Medicine", "medicine_inventory.csv");
+        save = allocationCount.load() - before;
+
+        before = allocationCount.load();
+        (void)manager.stockReport();
+        report = allocationCount.load() - before;
+    });
+    printAllocations("load (constructor)", rows, load);
+    printAllocations("category CSV writes", rows, save);
+    printAllocations("stockReport", rows, report);
+}
+
+// Heap traffic and teardown cost of one product per make_unique (the
+// original loader) versus products and strings carved out of an arena
+static void benchProductMemory(const fs::path& dir, size_t rows) {
+    fs::path path = dir / "electronics_bench.csv";
+    writeElectronicsCsv(path, rows);
+    cout << "\nProduct memory (" << rows << " electronics rows)\n";
+
+    auto measure = [rows](const string& name, auto load) {
+        size_t allocations = allocationCount.load();
+        size_t bytes = allocationBytes.load();
+        auto holder = load();
+        allocations = allocationCount.load() - allocations;
+        bytes = allocationBytes.load() - bytes;
+        auto start = Clock::now();
+        holder = decltype(holder)();
+        double teardown = secondsSince(start);
+        recordValue(name, "allocations/product", double(allocations) / rows);
+        recordValue(name, "bytes/product", double(bytes) / rows);
+        recordValue(name + " teardown", "ms", teardown * 1000.0);
+        cout << left << setw(36) << name << right
+             << setw(10) << fixed << setprecision(2) << double(allocations) / rows << " allocs/product"
+             << setw(10) << setprecision(1) << double(bytes) / rows << " bytes/product"
+             << setw(10) << setprecision(2) << teardown * 1000.0 << " ms teardown\n";
+    };
+
+    measure("heap products (legacy loader)", [&]() {
+        vector<unique_ptr<Product>> products;
+        legacyLoadElectronics(path, products);
+        return products;
+    });
+    measure("arena products", [&]() {
+        LoadedCatalog catalog;
+        MappedFile file;
+        file.open(path.string());
+        catalog.arenas.push_back(make_unique<ProductArena>(file.contents().size()));
+        CsvLoadReport report;
+        InventoryManager::parseCategoryRows(file.contents(), CategoryRegistry::ELECTRONICS,
+            *catalog.arenas.back(), report, [&catalog](ProductPtr& product) {
+                catalog.products.push_back(move(product));
+                return true;
+            });
+        return catalog;
+    });
+}
+
+// The original searchByName: lowercase every name (and the term) per query
+static size_t legacyNameSearch(const vector<ProductPtr>& inventory, const string& searchTerm) {
+    size_t matches = 0;
+    for (const auto& product : inventory) {
+        string productName(product->getName());
+        string searchTermLower = searchTerm;
+        transform(productName.begin(), productName.end(), productName.begin(), ::tolower);
+        transform(searchTermLower.begin(), searchTermLower.end(), searchTermLower.begin(), ::tolower);
+        if (productName.find(searchTermLower) != string::npos) matches++;
+    }
+    return matches;
+}
+
+static void benchNameSearch(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nName search (" << rows << " products, time per query)\n";
+    const vector<string> terms = {"LAPTOP 42", "syrup 49", "milk, 1l 7", "Pro\"", "xyz"};
+
+    LoadedCatalog catalog = loadCatalogProducts(dir);
+    vector<size_t> expected;
+    auto start = Clock::now();
+    for (const string& term : terms) expected.push_back(legacyNameSearch(catalog.products, term));
+    printResult("legacy lowercase scan", 1, secondsSince(start) / terms.size());
+    catalog = LoadedCatalog();
+
+    const int repeats = 20;
+    double searchTime = 0, firstPrefixTime = 0, prefixTime = 0;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        size_t found = 0;
+        auto searchStart = Clock::now();
+        for (int r = 0; r < repeats; r++) {
+            for (size_t t = 0; t < terms.size(); t++) {
+                size_t matches = manager.findByName(terms[t]).size();
+                if (r == 0 && matches != expected[t]) {
+                    cerr << "  index found " << matches << " for '" << terms[t] << "', scan found " << expected[t] << "\n";
+                }
+                found += matches;
+            }
+        }
+        searchTime = secondsSince(searchStart) / (repeats * terms.size());
+
+        // The first prefix query sorts every name loaded since the last one
+        const vector<string> prefixes = {"lap", "Cough Syrup 4", "Bread 99"};
+        auto firstStart = Clock::now();
+        found += manager.autocompleteName("a").size();
+        firstPrefixTime = secondsSince(firstStart);
+        auto prefixStart = Clock::now();
+        for (int r = 0; r < repeats; r++) {
+            for (const string& prefix : prefixes) found += manager.autocompleteName(prefix).size();
+        }
+        prefixTime = secondsSince(prefixStart) / (repeats * prefixes.size());
+        volatile size_t sink = found;
+        (void)sink;
+    });
+    printResult("trigram index findByName", 1, searchTime);
+    printResult("autocompleteName, first after load", 1, firstPrefixTime);
+    printResult("autocompleteName (10 results)", 1, prefixTime);
+}
+
+// Cost of persisting one changed product: rewriting every category file (the
+// old saveToFiles), rewriting only the dirty category, and appending to the
+// change log
+static void benchIncrementalSave(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nSave after one change (" << rows << " products)\n";
+
+    double fullRewrite = 0, dirtyRewrite = 0, changeLog = 0, compaction = 0;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        auto start = Clock::now();
+        manager.exportCategoryToCsv("Electronics", "electronics_inventory.csv");
+        manager.exportCategoryToCsv("Food", "food_inventory.csv");
+        manager.exportCategoryToCsv("Medicine", "medicine_inventory.csv");
+        fullRewrite = secondsSince(start);
+
+        manager.updateStock("F1", -1);
+        start = Clock::now();
+        manager.saveToFiles();
+        dirtyRewrite = secondsSince(start);
+
+        // Every change is synced to the change log before it returns
+        manager.setSaveMode(InventoryManager::SaveMode::ChangeLog);
+        start = Clock::now();
+        manager.updateStock("F2", -1);
+        changeLog = secondsSince(start);
+
+        // Formatting happens up front; the file writes run in the background
+        start = Clock::now();
+        manager.compactChangeLog();
+        compaction = secondsSince(start);
+        manager.setSaveMode(InventoryManager::SaveMode::Rewrite);
+    });
+    printResult("rewrite all category files", 1, fullRewrite);
+    printResult("rewrite dirty category only", 1, dirtyRewrite);
+    printResult("updateStock + synced log append", 1, changeLog);
+    printResult("start background compaction", 1, compaction);
+}
+
+// The original save path: one row string per product, each line flushed by endl
+static void legacyEndlSave(const vector<ProductPtr>& products, const fs::path& path) {
+    ofstream file(path);
+    for (const auto& product : products) {
+        string row;
+        product->toCsvRow(row);
+        file << row << endl;
+    }
+}
+
+static void benchSaveThroughput(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nFull save (" << rows << " products)\n";
+
+    LoadedCatalog catalog = loadCatalogProducts(dir);
+    auto start = Clock::now();
+    legacyEndlSave(catalog.products, dir / "legacy_save.csv");
+    printResult("legacy endl-per-row save", catalog.products.size(), secondsSince(start));
+    catalog = LoadedCatalog();
+    fs::remove(dir / "legacy_save.csv");
+
+    double save = 0;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        for (const char* id : {"E0", "F0", "M0"}) manager.updateStock(id, 0);
+        auto saveStart = Clock::now();
+        manager.saveToFiles();
+        save = secondsSince(saveStart);
+    });
+    printResult("atomic buffered save (fsync+rename)", rows, save);
+}
+
+// Cold start from the CSV files versus from the binary snapshot written by
+// the previous save
+static void benchSnapshotStartup(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    fs::remove(dir / "inventory.snapshot");
+    cout << "\nStartup (" << rows << " products)\n";
+
+    double csvStart = 0, snapshotSave = 0, snapshotStart = 0;
+    size_t csvCount = 0, snapshotCount = 0;
+    inDataDirectory(dir, [&]() {
+        {
+            auto start = Clock::now();
+            InventoryManager manager;
+            csvStart = secondsSince(start);
+            csvCount = manager.getProductCount();
+            start = Clock::now();
+            manager.saveToFiles();
+            snapshotSave = secondsSince(start);
+        }
+        auto start = Clock::now();
+        InventoryManager manager;
+        snapshotStart = secondsSince(start);
+        snapshotCount = manager.getProductCount();
+    });
+    if (snapshotCount != csvCount) {
+        cerr << "  snapshot loaded " << snapshotCount << " products, CSV files " << csvCount << "\n";
+    }
+    printResult("start from CSV files", csvCount, csvStart);
+    printResult("save (writes snapshot)", csvCount, snapshotSave);
+    printResult("start from snapshot", snapshotCount, snapshotStart);
+    cout << "snapshot size " << fs::file_size(dir / "inventory.snapshot") / (1 << 20) << " MiB\n";
+}
+
+// Run op on each of threads workers for about seconds; returns the total
+// number of operations done
+template <typename Op>
+static size_t runWorkers(unsigned threads, double seconds, Op op) {
+    atomic<bool> stop{false};
+    vector<size_t> counts(threads);
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            mt19937 rng(t + 1);
+            size_t done = 0;
+            while (!stop.load(memory_order_relaxed)) {
+                for (int i = 0; i < 64; i++) op(rng, done++);
+            }
+            counts[t] = done;
+        });
+    }
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stop = true;
+    for (thread& worker : workers) worker.join();
+    size_t total = 0;
+    for (size_t count : counts) total += count;
+    return total;
+}
+
+// ConcurrentInventory throughput as worker threads are added: read-only
+// lookups, and a till-like mix of one synced stock update per 100 lookups.
+// The mix also runs behind one global mutex, the only safe way to share an
+// InventoryManager before it had shard locks.
+static void benchConcurrentAccess(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nConcurrent access (" << rows << " products, "
+         << thread::hardware_concurrency() << " hardware threads)\n";
+
+    vector<string> ids;
+    for (size_t i = 0; i < rows / 2; i++) ids.push_back("E" + to_string(i));
+    for (size_t i = 0; i < rows / 4; i++) ids.push_back("F" + to_string(i));
+    for (size_t i = 0; i < rows - rows / 2 - rows / 4; i++) ids.push_back("M" + to_string(i));
+
+    const double seconds = 0.25;
+    vector<tuple<string, size_t, double>> results;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        ConcurrentInventory shared(manager);
+        mutex global;
+        for (unsigned threads : {1u, 2u, 4u, 8u, 16u, 32u}) {
+            string suffix = ", " + to_string(threads) + " threads";
+            atomic<long long> stock{0};
+            size_t ops = runWorkers(threads, seconds, [&](mt19937& rng, size_t) {
+                shared.readProduct(ids[rng() % ids.size()], [&](const Product& p) {
+                    stock.fetch_add(p.getQuantity(), memory_order_relaxed);
+                });
+            });
+            results.emplace_back("sharded lookups" + suffix, ops, seconds);
+
+            ops = runWorkers(threads, seconds, [&](mt19937& rng, size_t i) {
+                const string& id = ids[rng() % ids.size()];
+                if (i % 100 == 0) shared.updateStock(id, (i & 128) ? 1 : -1);
+                else shared.readProduct(id, [](const Product& p) { (void)p.getQuantity(); });
+            });
+            results.emplace_back("sharded 99:1 mix" + suffix, ops, seconds);
+
+            ops = runWorkers(threads, seconds, [&](mt19937& rng, size_t i) {
+                const string& id = ids[rng() % ids.size()];
+                lock_guard<mutex> lock(global);
+                if (i % 100 == 0) manager.updateStock(id, (i & 128) ? 1 : -1);
+                else (void)manager.searchById(id)->getQuantity();
+            });
+            results.emplace_back("global mutex 99:1 mix" + suffix, ops, seconds);
+        }
+        auto start = Clock::now();
+        StockSummary summary = shared.summarize();
+        results.emplace_back("summarize (all shards shared)", summary.overall.products, secondsSince(start));
+    });
+    for (const auto& [name, ops, time] : results) printResult(name, ops, time);
+}
+
+// Stock counters under contention: every thread sells and restocks a few hot
+// SKUs. A plain int behind a mutex (the old updateStock made thread-safe)
+// against the atomic fetch_add path and reserve/commit checkouts. Counters
+// only; the change log is left out so the sync does not hide them.
+static void benchStockContention(const fs::path&, size_t) {
+    cout << "\nHot-SKU stock updates (4 products, " << thread::hardware_concurrency() << " hardware threads)\n";
+    const int start = 1 << 30;
+    const double seconds = 0.25;
+    vector<unique_ptr<Electronic>> hot;
+    for (int i = 0; i < 4; i++) hot.push_back(make_unique<Electronic>("H" + to_string(i), "Hot", 100, start, "Acme", 12));
+
+    for (unsigned threads : {1u, 4u, 16u, 32u}) {
+        string suffix = ", " + to_string(threads) + " threads";
+        struct alignas(64) LockedCounter {
+            mutex lock;
+            int quantity = 0;
+        };
+        vector<LockedCounter> locked(hot.size());
+        size_t ops = runWorkers(threads, seconds, [&](mt19937&, size_t i) {
+            LockedCounter& counter = locked[i % locked.size()];
+            lock_guard<mutex> lock(counter.lock);
+            counter.quantity += (i & 4) ? 1 : -1;
+        });
+        printResult("mutex + int" + suffix, ops, seconds);
+
+        ops = runWorkers(threads, seconds, [&](mt19937&, size_t i) {
+            hot[i % hot.size()]->updateStock((i & 4) ? 1 : -1);
+        });
+        printResult("atomic updateStock" + suffix, ops, seconds);
+
+        atomic<size_t> sold{0};
+        ops = runWorkers(threads, seconds, [&](mt19937&, size_t i) {
+            Electronic& product = *hot[i % hot.size()];
+            if (product.reserveStock(1)) {
+                product.commitReservation(1);
+                sold.fetch_add(1, memory_order_relaxed);
+            }
+        });
+        printResult("reserve + commit" + suffix, ops, seconds);
+
+        long long total = 0;
+        for (const auto& product : hot) total += product->getQuantity();
+        long long expected = static_cast<long long>(start) * hot.size() - static_cast<long long>(sold.load());
+        if (total != expected) cerr << "  stock is " << total << ", expected " << expected << "\n";
+        for (const auto& product : hot) product->setQuantity(start);
+    }
+}
+
+// applyBatch against the same operations made one call at a time (each
+// synced to the change log before it returns, so only a sample is timed).
+// A day of till sales repeats a few thousand SKUs; the catalog-wide mix
+// touches a different product with almost every operation.
+static void benchBatchApply(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nBatched operations (" << rows << " products)\n";
+    const size_t electronics = rows / 2;
+    const size_t opCount = max<size_t>(rows, 1000);
+
+    auto tillSales = [&]() {
+        mt19937 rng(7);
+        vector<BatchOperation> ops;
+        ops.reserve(opCount);
+        for (size_t i = 0; i < opCount; i++) {
+            string id = "E" + to_string(rng() % min<size_t>(electronics, 5000));
+            ops.push_back(BatchOperation::adjustStock(id, (i % 50 == 0) ? 40 : -1));
+        }
+        return ops;
+    };
+    // Removes target the last 2.5% of the electronics, which nothing else touches
+    auto catalogMix = [&]() {
+        mt19937 rng(8);
+        size_t removable = electronics / 40;
+        vector<BatchOperation> ops;
+        ops.reserve(opCount);
+        size_t removed = 0, added = 0;
+        for (size_t i = 0; i < opCount; i++) {
+            unsigned pick = rng() % 40;
+            if (pick == 0 && removed < removable) {
+                ops.push_back(BatchOperation::remove("E" + to_string(electronics - 1 - removed++)));
+            } else if (pick == 1) {
+                ops.push_back(BatchOperation::add(ProductPtr(new Electronic(
+                    "B" + to_string(added++), "Batch Item", 999, 5, "Acme", 12))));
+            } else {
+                string id = "E" + to_string(rng() % (electronics - removable));
+                if (pick < 4) ops.push_back(BatchOperation::setPrice(id, Cents(rng() % 100000)));
+                else ops.push_back(BatchOperation::adjustStock(id, (rng() % 2) ? 1 : -1));
+            }
+        }
+        return ops;
+    };
+
+    vector<tuple<string, size_t, double>> results;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        for (auto& [name, build] : {pair<string, function<vector<BatchOperation>()>>{"till sales", tillSales},
+                                   pair<string, function<vector<BatchOperation>()>>{"catalog mix", catalogMix}}) {
+            vector<BatchOperation> ops = build();
+            const size_t sample = 2000;
+            auto start = Clock::now();
+            for (size_t i = 0; i < sample; i++) manager.updateStock(ops[i].id(), 0);
+            results.emplace_back(name + ": one call per op", sample, secondsSince(start));
+
+            start = Clock::now();
+            BatchResult result = manager.applyBatch(ops);
+            results.emplace_back(name + ": applyBatch", ops.size(), secondsSince(start));
+            if (!result.applied) cerr << "  " << name << " batch was rejected\n";
+        }
+
+        // A batch with one bad operation is rejected whole
+        vector<BatchOperation> ops = tillSales();
+        ops.push_back(BatchOperation::remove("no such product"));
+        auto start = Clock::now();
+        BatchResult result = manager.applyBatch(ops);
+        results.emplace_back("rejected batch (dry run only)", ops.size(), secondsSince(start));
+        if (result.applied || result.statuses.back() != OpStatus::NotFound) cerr << "  bad batch was applied\n";
+    });
+    for (const auto& [name, ops, time] : results) printResult(name, ops, time);
+}
+
+// Reference copy of the original table output: every row streamed to cout
+// with setw and flushed by endl (the columns all product types share)
+static void legacyDisplayRow(const Product& product, ostream& out) {
+    out << left << setw(12) << product.getProductId()
+        << setw(20) << product.getName()
+        << setw(12) << product.getCategory()
+        << setw(10) << "$" << fixed << setprecision(2) << product.getPrice() / 100.0
+        << setw(8) << product.getQuantity() << endl;
+}
+
+// Printing the full product table to a file, row by row with a flush per
+// row versus one buffer built by ConsoleRenderer and written once
+static void benchTableRender(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nProduct table output (" << rows << " products)\n";
+
+    double legacy = 0, buffered = 0;
+    size_t products = 0;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        products = manager.getProductCount();
+        {
+            ofstream out("table_legacy.txt");
+            auto start = Clock::now();
+            manager.forEachProduct([&out](const Product& product) { legacyDisplayRow(product, out); });
+            legacy = secondsSince(start);
+        }
+
+        ofstream out("table_buffered.txt");
+        streambuf* console = cout.rdbuf(out.rdbuf());
+        auto start = Clock::now();
+        ConsoleRenderer screen;
+        screen.tableStart("INVENTORY REPORT");
+        manager.forEachProduct([&screen](const Product& product) { screen.product(product); });
+        screen.write();
+        cout.flush();
+        buffered = secondsSince(start);
+        cout.rdbuf(console);
+    });
+    printResult("legacy setw/endl per row", products, legacy);
+    printResult("ConsoleRenderer, one write", products, buffered);
+}
+
+// Scripted quantity updates: keystrokes piped through the interactive menu
+// (a menu screen and a change log sync per update) versus the command mode
+static void benchCommandMode(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    size_t electronics = max<size_t>(1, rows / 2);
+    size_t menuUpdates = min<size_t>(electronics, 2000);
+    cout << "\nScripted updates (" << rows << " products)\n";
+
+    string keystrokes, commands;
+    for (size_t i = 0; i < menuUpdates; i++) {
+        keystrokes += "8\nE" + to_string(i) + "\n3\n" + to_string(i % 50) + "\n";
+    }
+    keystrokes += "12\n";
+    for (size_t i = 0; i < rows; i++) {
+        commands += "update,E" + to_string(i % electronics) + ",quantity," + to_string(i % 50) + "\n";
+    }
+
+    double menu = 0, batch = 0;
+    inDataDirectory(dir, [&]() {
+        ofstream sink("console.txt");
+        streambuf* console = cout.rdbuf(sink.rdbuf());
+        istringstream input(keystrokes);
+        streambuf* keyboard = cin.rdbuf(input.rdbuf());
+        {
+            InventoryApp app;
+            auto start = Clock::now();
+            app.run();
+            menu = secondsSince(start);
+        }
+        cin.rdbuf(keyboard);
+        {
+            InventoryApp app;
+            auto start = Clock::now();
+            app.runCommands(commands);
+            batch = secondsSince(start);
+        }
+        cout.rdbuf(console);
+    });
+    printResult("menu keystrokes (interactive run)", menuUpdates, menu);
+    printResult("command mode (runCommands)", rows, batch);
+}
+
+// Range queries through the ordered price, quantity and expiry indexes
+// versus scanning every product, plus what keeping the indexes costs
+static void benchRangeQueries(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nRange queries (" << rows << " products)\n";
+
+    const int queries = 200;
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        mt19937 rng(5);
+        int32_t today = parseExpiryDays("01/01/2025");
+
+        auto restock = [&]() {
+            manager.setSyncDeferred(true);
+            auto start = Clock::now();
+            for (size_t i = 0; i < rows; i++) {
+                manager.updateStock("E" + to_string(i % max<size_t>(1, rows / 2)), (i & 1) ? 1 : -1);
+            }
+            double seconds = secondsSince(start);
+            manager.setSyncDeferred(false);
+            return seconds;
+        };
+        double plainUpdates = restock();
+
+        size_t scanned = 0;
+        auto start = Clock::now();
+        for (int q = 0; q < queries; q++) {
+            Cents low = Cents(rng() % 1000) * 100;
+            manager.forEachProduct([&](const Product& p) { scanned += p.getPrice() >= low && p.getPrice() <= low + 100; });
+            int32_t from = today + int32_t(rng() % 700);
+            manager.forEachProduct([&](const Product& p) {
+                scanned += p.getExpiryDays() >= from && p.getExpiryDays() <= from + 7;
+            });
+            manager.forEachProduct([&](const Product& p) { scanned += p.getQuantity() < 2; });
+        }
+        double scan = secondsSince(start);
+
+        start = Clock::now();
+        manager.findLowStock(0);
+        double build = secondsSince(start);
+
+        rng.seed(5);
+        size_t found = 0;
+        start = Clock::now();
+        for (int q = 0; q < queries; q++) {
+            Cents low = Cents(rng() % 1000) * 100;
+            found += manager.findByPriceRange(low, low + 100).size();
+            int32_t from = today + int32_t(rng() % 700);
+            found += manager.findExpiringBetween(from, from + 7).size();
+            found += manager.findLowStock(2).size();
+        }
+        double indexed = secondsSince(start);
+        if (found != scanned) cout << "  index found " << found << " products, scan found " << scanned << "\n";
+
+        // With the indexes built each stock change moves one quantity entry
+        double indexedUpdates = restock();
+
+        printResult("full scans (3 per round)", size_t(queries) * 3, scan);
+        printResult("build the range indexes", rows, build);
+        printResult("indexed range queries", size_t(queries) * 3, indexed);
+        printResult("stock updates, no indexes", rows, plainUpdates);
+        printResult("stock updates, indexes kept", rows, indexedUpdates);
+        cout << "  " << found << " products matched\n";
+    });
+}
+
+// Delisting and relisting 10% of the catalog per round, with handles held
+// to every product from before the churn
+static void benchCatalogChurn(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nCatalog churn (" << rows << " products)\n";
+    size_t electronics = rows / 2;
+    size_t churn = rows / 10;
+
+    // The original container: find_if by ID, then vector::erase
+    LoadedCatalog catalog = loadCatalogProducts(dir);
+    size_t legacyOps = min<size_t>(churn, 2000);
+    auto start = Clock::now();
+    for (size_t i = 0; i < legacyOps; i++) {
+        string id = "E" + to_string(i * 5);
+        auto it = find_if(catalog.products.begin(), catalog.products.end(),
+                          [&](const ProductPtr& p) { return p->getProductId() == id; });
+        if (it != catalog.products.end()) catalog.products.erase(it);
+    }
+    printResult("legacy find_if + vector::erase", legacyOps, secondsSince(start));
+    catalog = LoadedCatalog();
+
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        manager.setSyncDeferred(true);
+        vector<ProductHandle> held;
+        held.reserve(manager.getProductCount());
+        manager.forEachProduct([&](const Product& p) { held.push_back(manager.handleOf(p.getProductId())); });
+
+        const int rounds = 3;
+        vector<size_t> order(electronics);
+        for (size_t i = 0; i < electronics; i++) order[i] = i;
+        mt19937 rng(21);
+        unordered_set<size_t> delisted;
+        size_t operations = 0;
+        start = Clock::now();
+        for (int r = 0; r < rounds; r++) {
+            shuffle(order.begin(), order.end(), rng);
+            for (size_t k = 0; k < churn && k < electronics; k++) {
+                manager.removeProduct("E" + to_string(order[k]));
+                delisted.insert(order[k]);
+            }
+            for (size_t k = 0; k < churn && k < electronics; k++) {
+                string id = "E" + to_string(order[k]);
+                manager.addProduct(make_unique<Electronic>(id, "Relisted " + id, 1000, 5, "Acme", 12));
+            }
+            operations += 2 * min(churn, electronics);
+        }
+        double churnSeconds = secondsSince(start);
+
+        size_t stale = 0;
+        start = Clock::now();
+        for (ProductHandle handle : held) stale += manager.resolve(handle) == nullptr;
+        double resolveSeconds = secondsSince(start);
+
+        printResult("delist + relist 10% (3 rounds)", operations, churnSeconds);
+        printResult("resolve pre-churn handles", held.size(), resolveSeconds);
+        cout << "  " << stale << " stale handles for " << delisted.size() << " products delisted"
+             << (stale == delisted.size() ? "" : " - MISMATCH") << "\n";
+        manager.setSyncDeferred(false);
+    });
+}
+
+// Dashboard polling: reports interleaved with stock changes, recomputed by a
+// scan each time versus served from the running totals
+static void benchRunningTotals(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nRunning report totals (" << rows << " products)\n";
+
+    const size_t reports = 100;
+    const size_t updatesPerReport = 1000;
+    size_t electronics = max<size_t>(1, rows / 2);
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        manager.setSyncDeferred(true);
+        mt19937 rng(9);
+        auto poll = [&](bool running) {
+            size_t lowStock = 0;
+            auto start = Clock::now();
+            for (size_t r = 0; r < reports; r++) {
+                for (size_t u = 0; u < updatesPerReport; u++) {
+                    manager.updateStock("E" + to_string(rng() % electronics), (rng() & 1) ? 3 : -3);
+                }
+                lowStock += running ? manager.stockReport().lowStock.size()
+                                    : manager.recomputeStockReport().lowStock.size();
+            }
+            double seconds = secondsSince(start);
+            return make_pair(seconds, lowStock);
+        };
+        auto scanned = poll(false);
+
+        auto start = Clock::now();
+        manager.stockReport();
+        double build = secondsSince(start);
+        auto running = poll(true);
+
+        printResult("recomputed reports", reports, scanned.first);
+        printResult("build the running totals", rows, build);
+        printResult("running-total reports", reports, running.first);
+        cout << "  " << reports * updatesPerReport << " stock changes between reports, "
+             << (manager.stockTotalsConsistent() ? "totals match a full recompute" : "TOTALS DISAGREE with a full recompute")
+             << "\n";
+        manager.setSyncDeferred(false);
+    });
+}
+
+// Expiry tracking on an all-perishable catalog: a simulated run of days,
+// each pulling the stock that expired and listing what expires within a
+// week, answered by full scans and by the expiry heap
+static void benchExpiryTracking(const fs::path& dir, size_t rows) {
+    writeElectronicsCsv(dir / "electronics_inventory.csv", 0);
+    writeFoodCsv(dir / "food_inventory.csv", rows / 2);
+    writeMedicineCsv(dir / "medicine_inventory.csv", rows - rows / 2);
+    cout << "\nExpiry tracking (" << rows << " perishable products)\n";
+
+    const int days = 60;
+    const int alertDays = 7;
+    inDataDirectory(dir, [&]() {
+        InventoryManager scanned;
+        InventoryManager tracked;
+        scanned.setSyncDeferred(true);
+        tracked.setSyncDeferred(true);
+        int32_t first = parseExpiryDays("01/01/2025");
+
+        size_t scanPulled = 0, scanAlerts = 0;
+        auto start = Clock::now();
+        for (int32_t today = first; today < first + days; today++) {
+            vector<string> expired;
+            scanned.forEachProduct([&](const Product& p) {
+                if (p.getExpiryDays() < today && p.getQuantity() > 0) expired.emplace_back(p.getProductId());
+            });
+            for (const string& id : expired) scanned.setQuantity(id, 0);
+            scanPulled += expired.size();
+
+            vector<pair<int32_t, const Product*>> due;
+            scanned.forEachProduct([&](const Product& p) {
+                if (p.getExpiryDays() <= today + alertDays - 1 && p.getQuantity() > 0) {
+                    due.emplace_back(p.getExpiryDays(), &p);
+                }
+            });
+            sort(due.begin(), due.end());
+            scanAlerts += due.size();
+        }
+        double scan = secondsSince(start);
+
+        start = Clock::now();
+        tracked.expiringWithin(0, first);
+        double build = secondsSince(start);
+
+        size_t heapPulled = 0, heapAlerts = 0;
+        start = Clock::now();
+        for (int32_t today = first; today < first + days; today++) {
+            heapPulled += tracked.pullExpiredStock(today).pulled.size();
+            heapAlerts += tracked.expiringWithin(alertDays, today).size();
+        }
+        double heap = secondsSince(start);
+        if (heapPulled != scanPulled || heapAlerts != scanAlerts) {
+            cout << "  heap pulled " << heapPulled << " and listed " << heapAlerts << ", scan pulled "
+                 << scanPulled << " and listed " << scanAlerts << "\n";
+        }
+
+        printResult("full scans (2 per day)", size_t(days) * 2, scan);
+        printResult("build range indexes and heap", rows, build);
+        printResult("expiry heap (pull + alert per day)", size_t(days) * 2, heap);
+        cout << "  " << days << " days: " << heapPulled << " products pulled, " << heapAlerts << " expiry alerts\n";
+        scanned.setSyncDeferred(false);
+        tracked.setSyncDeferred(false);
+    });
+}
+
+#if IMS_HAVE_EPOLL
+// One load-generator client: keeps depth requests in flight on its own
+// connection until it has sent total, recording each request's latency
+static void runServerClient(const string& socketPath, size_t electronics, size_t total, size_t depth,
+                            unsigned seed, vector<double>& latencies) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    // 95% lookups, 5% stock adjustments
+    mt19937 rng(seed);
+    string out;
+    auto request = [&]() {
+        string id = "E" + to_string(rng() % electronics);
+        out += (rng() % 20 == 0) ? "stock," + id + "," + ((rng() & 1) ? "1" : "-1") + "\n" : "get," + id + "\n";
+    };
+    deque<Clock::time_point> inFlight;
+    size_t sent = 0;
+    vector<char> buffer(64 * 1024);
+    string pending;
+    while (sent < total || !inFlight.empty()) {
+        while (sent < total && inFlight.size() < depth) {
+            request();
+            inFlight.push_back(Clock::now());
+            sent++;
+        }
+        if (!out.empty()) {
+            if (send(fd, out.data(), out.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(out.size())) break;
+            out.clear();
+        }
+        ssize_t received = recv(fd, buffer.data(), buffer.size(), 0);
+        if (received <= 0) break;
+        auto now = Clock::now();
+        for (ssize_t i = 0; i < received; i++) {
+            if (buffer[i] != '\n' || inFlight.empty()) continue;
+            latencies.push_back(chrono::duration<double>(now - inFlight.front()).count());
+            inFlight.pop_front();
+        }
+    }
+    close(fd);
+}
+
+// Query server over a Unix socket: QPS and p50/p99 latency for clients
+// sending one request at a time versus pipelining many
+static void benchServer(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    size_t electronics = max<size_t>(1, rows / 2);
+    const unsigned clients = 4;
+    const size_t perClient = 20000;
+    cout << "\nQuery server, " << clients << " clients, 95% get / 5% stock (" << rows << " products)\n";
+
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        InventoryServer server(manager);
+        string socketPath = (dir / "ims_bench.sock").string();
+        string error;
+        if (!server.listen(socketPath, error)) {
+            cout << "  " << error << "\n";
+            return;
+        }
+        thread serverThread([&server]() { server.run(); });
+
+        for (size_t depth : {size_t(1), size_t(32)}) {
+            vector<vector<double>> latencies(clients);
+            vector<thread> workers;
+            auto start = Clock::now();
+            for (unsigned c = 0; c < clients; c++) {
+                workers.emplace_back([&, c]() {
+                    runServerClient(socketPath, electronics, perClient, depth, c + 1, latencies[c]);
+                });
+            }
+            for (thread& worker : workers) worker.join();
+            double seconds = secondsSince(start);
+
+            vector<double> all;
+            for (const auto& client : latencies) all.insert(all.end(), client.begin(), client.end());
+            sort(all.begin(), all.end());
+            auto percentile = [&all](double p) { return all.empty() ? 0.0 : all[size_t(p * (all.size() - 1))]; };
+            string name = "pipeline depth " + to_string(depth);
+            printResult(name, all.size(), seconds);
+            recordValue(name + " latency p50", "us", percentile(0.50) * 1e6);
+            recordValue(name + " latency p99", "us", percentile(0.99) * 1e6);
+            cout << "  " << left << setw(34) << "latency p50 / p99" << right << fixed << setprecision(1)
+                 << setw(12) << percentile(0.50) * 1e6 << " us" << setw(12) << percentile(0.99) * 1e6 << " us\n";
+        }
+
+        server.stop();
+        serverThread.join();
+    });
+}
+#endif
+
+// The engine's main entry points one after another on one catalog
+static void benchCoreOperations(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    fs::remove(dir / "inventory.snapshot");
+    cout << "\nCore operations (" << rows << " products)\n";
+
+    inDataDirectory(dir, [&]() {
+        auto start = Clock::now();
+        InventoryManager manager;
+        printResult("constructor (CSV load)", manager.getProductCount(), secondsSince(start));
+
+        start = Clock::now();
+        manager.loadFromFiles();
+        printResult("loadFromFiles", manager.getProductCount(), secondsSince(start));
+
+        start = Clock::now();
+        manager.loadFromFilesParallel();
+        printResult("loadFromFilesParallel", manager.getProductCount(), secondsSince(start));
+        manager.takeMessages();
+
+        vector<string> ids;
+        ids.reserve(manager.getProductCount());
+        manager.forEachProduct([&](const Product& p) { ids.emplace_back(p.getProductId()); });
+        mt19937 rng(22);
+        const size_t lookups = 1000000;
+        vector<uint32_t> picks(lookups);
+        for (uint32_t& pick : picks) pick = ids.empty() ? 0 : uint32_t(rng() % ids.size());
+        size_t found = 0;
+        start = Clock::now();
+        for (uint32_t pick : picks) found += manager.searchById(ids.empty() ? "none" : ids[pick]) != nullptr;
+        printResult("searchById", lookups, secondsSince(start));
+
+        // Item name plus model number, as a till clerk types them
+        const char* terms[] = {"laptop 12", "cable 42", "milk, 1l 7", "vitamin a tablets 9", "15\" \"pro",
+                               "syrup 4", "zzz"};
+        start = Clock::now();
+        manager.findByName("cable");
+        printResult("findByName (first, builds index)", rows, secondsSince(start));
+        const size_t searches = 1000;
+        start = Clock::now();
+        for (size_t q = 0; q < searches; q++) found += manager.findByName(terms[q % 7]).size();
+        printResult("findByName", searches, secondsSince(start));
+
+        start = Clock::now();
+        manager.stockReport();
+        printResult("stockReport (first, builds totals)", rows, secondsSince(start));
+        const size_t reports = 100;
+        start = Clock::now();
+        for (size_t r = 0; r < reports; r++) found += manager.stockReport().lowStock.size();
+        printResult("stockReport", reports, secondsSince(start));
+
+        start = Clock::now();
+        manager.exportCategoryToCsv("Electronics", "electronics_export.csv");
+        printResult("exportCategoryToCsv (Electronics)", rows / 2, secondsSince(start));
+        start = Clock::now();
+        manager.exportCategoryToCsv("Electronics", "electronics_low_stock.csv",
+            [](const Product& p) { return p.getQuantity() < 10; });
+        printResult("exportCategoryToCsv (Electronics, quantity < 10)", rows / 2, secondsSince(start));
+
+        // One change per category so every file is rewritten
+        for (const char* id : {"E0", "F0", "M0"}) manager.updateStock(id, 1);
+        start = Clock::now();
+        manager.saveToFiles();
+        printResult("saveToFiles (all categories)", manager.getProductCount(), secondsSince(start));
+        if (found == 0) cout << "  nothing found\n";
+    });
+}
+
+// A till-like mix on one thread: 80% lookups, 15% stock changes, 3% name
+// searches, 1.9% price changes and 0.1% reports. Changes are synced to the
+// change log in groups, as in command mode.
+static void benchMixedWorkload(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nMixed workload (" << rows << " products)\n";
+    size_t perCategory[] = {max<size_t>(1, rows / 2), max<size_t>(1, rows / 4), max<size_t>(1, rows - rows / 2 - rows / 4)};
+    const char prefixes[] = {'E', 'F', 'M'};
+    const char* terms[] = {"laptop 12", "cable 42", "milk, 1l 7", "vitamin a tablets 9", "syrup 4"};
+
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        manager.stockReport();
+        manager.findByName("warm");
+        manager.setSyncDeferred(true);
+        mt19937 rng(23);
+        const size_t operations = 200000;
+        size_t counts[5] = {};
+        auto start = Clock::now();
+        for (size_t i = 0; i < operations; i++) {
+            unsigned category = rng() % 3;
+            string id = prefixes[category] + to_string(rng() % perCategory[category]);
+            unsigned roll = rng() % 1000;
+            if (roll < 800) {
+                counts[0] += manager.searchById(id) != nullptr;
+            } else if (roll < 950) {
+                counts[1] += manager.updateStock(id, (rng() & 1) ? 1 : -1) == OpStatus::Ok;
+            } else if (roll < 980) {
+                counts[2] += manager.findByName(terms[rng() % 5]).size() > 0;
+            } else if (roll < 999) {
+                counts[3] += manager.setPrice(id, Cents(rng() % 10000)) == OpStatus::Ok;
+            } else {
+                counts[4] += manager.stockReport().summary.overall.products > 0;
+            }
+            if ((i & 0xffff) == 0xffff) manager.syncPendingChanges();
+        }
+        manager.setSyncDeferred(false);
+        printResult("mixed operations", operations, secondsSince(start));
+        cout << "  " << counts[0] << " lookups, " << counts[1] << " stock changes, " << counts[2] << " searches, "
+             << counts[3] << " price changes, " << counts[4] << " reports\n";
+    });
+}
+
+// Cost of the operation stats: the same lookups, stock changes and reports
+// with recording off and on, alternating to even out noise
+static void benchStatsOverhead(const fs::path& dir, size_t rows) {
+    writeCatalog(dir, rows);
+    cout << "\nOperation stats overhead (" << rows << " products)\n";
+
+    inDataDirectory(dir, [&]() {
+        InventoryManager manager;
+        manager.setSyncDeferred(true);
+        manager.stockReport();
+        vector<string> ids;
+        manager.forEachProduct([&](const Product& p) { ids.emplace_back(p.getProductId()); });
+        mt19937 rng(24);
+        const size_t calls = 2000000;
+        vector<uint32_t> picks(calls);
+        for (uint32_t& pick : picks) pick = uint32_t(rng() % max<size_t>(1, ids.size()));
+
+        // 90% lookups, 10% stock changes and a report every 10000 calls
+        auto workload = [&]() {
+            size_t found = 0;
+            auto start = Clock::now();
+            for (size_t i = 0; i < calls; i++) {
+                const string& id = ids[picks[i]];
+                if (i % 10000 == 0) {
+                    found += manager.stockReport().summary.overall.products;
+                } else if (i % 10 == 0) {
+                    found += manager.updateStock(id, (i & 1) ? 1 : -1) == OpStatus::Ok;
+                } else {
+                    found += manager.searchById(id) != nullptr;
+                }
+            }
+            double seconds = secondsSince(start);
+            if (found == 0) cout << "  nothing found\n";
+            return seconds;
+        };
+
+        OperationStats& stats = OperationStats::instance();
+        double off = 1e30, on = 1e30;
+        for (int round = 0; round < 3; round++) {
+            stats.setEnabled(false);
+            off = min(off, workload());
+            stats.setEnabled(true);
+            on = min(on, workload());
+        }
+        manager.setSyncDeferred(false);
+
+        printResult("mixed calls, stats off (best of 3)", calls, off);
+        printResult("mixed calls, stats on (best of 3)", calls, on);
+        recordValue("stats overhead", "%", (on / off - 1) * 100);
+        cout << "  overhead " << fixed << setprecision(2) << (on / off - 1) * 100 << "%\n";
+
+        OperationStatsSnapshot snapshot = stats.snapshot();
+        const LatencyHistogram& lookups = snapshot[StatOp::Lookup];
+        cout << "  lookup p50 / p99 " << lookups.percentile(0.50) << " / " << lookups.percentile(0.99) << " ns over "
+             << lookups.calls << " calls\n";
+    });
+}
+
+// Write records as JSON: {"rows": n, "results": [...]}
+static bool writeJsonResults(const string& path, size_t rows) {
+    auto quoted = [](const string& text) {
+        string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    };
+    string out = "{\"rows\": " + to_string(rows) + ", \"results\": [\n";
+    for (size_t i = 0; i < benchRecords.size(); i++) {
+        const BenchRecord& record = benchRecords[i];
+        out += "  {\"benchmark\": " + quoted(record.benchmark) + ", \"name\": " + quoted(record.name);
+        char numbers[160];
+        if (record.unit.empty()) {
+            snprintf(numbers, sizeof(numbers), ", \"items\": %zu, \"seconds\": %.9g, \"items_per_second\": %.6g}",
+                     record.items, record.seconds, record.seconds > 0 ? record.items / record.seconds : 0.0);
+        } else {
+            snprintf(numbers, sizeof(numbers), ", \"value\": %.9g, \"unit\": ", record.value);
+        }
+        out += numbers;
+        if (!record.unit.empty()) out += quoted(record.unit) + "}";
+        out += (i + 1 < benchRecords.size()) ? ",\n" : "\n";
+    }
+    out += "]}\n";
+    ofstream file(path, ios::binary);
+    file << out;
+    return bool(file);
+}
+
+// Row count with an optional k or m suffix; 0 if the text is not one
+static size_t parseRows(const string& text) {
+    size_t value = 0;
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec != errc() || result.ptr == text.data()) return 0;
+    string suffix(result.ptr, text.data() + text.size());
+    if (suffix == "k" || suffix == "K") return value * 1000;
+    if (suffix == "m" || suffix == "M") return value * 1000000;
+    return suffix.empty() ? value : 0;
+}
+
+int main(int argc, char** argv) {
+    vector<string> args(argv + 1, argv + argc);
+    auto usage = []() {
+        cerr << "Usage: ims_bench [rows] [benchmark] [--json results.json]\n"
+                "       ims_bench --generate <dir> [rows]\n";
+        return 2;
+    };
+
+    if (!args.empty() && args[0] == "--generate") {
+        size_t rows = (args.size() > 2) ? parseRows(args[2]) : 1000000;
+        if (args.size() < 2 || args.size() > 3 || rows == 0) return usage();
+        fs::create_directories(args[1]);
+        writeCatalog(args[1], rows);
+        cout << "Wrote " << rows << " products to " << args[1] << "\n";
+        return 0;
+    }
+
+    string jsonPath;
+    vector<string> positional;
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--json" && i + 1 < args.size()) {
+            jsonPath = args[++i];
+        } else if (args[i].rfind("--", 0) == 0) {
+            return usage();
+        } else {
+            positional.push_back(args[i]);
+        }
+    }
+    size_t rows = positional.empty() ? 1000000 : parseRows(positional[0]);
+    string only = (positional.size() > 1) ? positional[1] : "";
+    if (rows == 0 || positional.size() > 2) return usage();
+    fs::path dir = fs::temp_directory_path() / "ims_bench";
+    fs::create_directories(dir);
+
+    const vector<pair<string, void (*)(const fs::path&, size_t)>> benchmarks = {
+        {"core", benchCoreOperations},
+        {"mixed", benchMixedWorkload},
+        {"csv", benchCsvLoad},
+        {"parallel", benchParallelLoad},
+        {"report", benchStockReport},
+        {"alloc", benchAllocations},
+        {"memory", benchProductMemory},
+        {"search", benchNameSearch},
+        {"incremental", benchIncrementalSave},
+        {"save", benchSaveThroughput},
+        {"startup", benchSnapshotStartup},
+        {"concurrent", benchConcurrentAccess},
+        {"contention", benchStockContention},
+        {"batch", benchBatchApply},
+        {"render", benchTableRender},
+        {"commands", benchCommandMode},
+        {"range", benchRangeQueries},
+        {"totals", benchRunningTotals},
+        {"churn", benchCatalogChurn},
+        {"stats", benchStatsOverhead},
+        {"expiry", benchExpiryTracking},
+#if IMS_HAVE_EPOLL
+        {"server", benchServer},
+#endif
+    };
+    bool ran = false;
+    for (const auto& bench : benchmarks) {
+        if (!only.empty() && only != bench.first) continue;
+        currentBenchmark = bench.first;
+        bench.second(dir, rows);
+        ran = true;
+    }
+    fs::remove_all(dir);
+    if (!ran) {
+        cerr << "Unknown benchmark '" << only << "'\n";
+        return usage();
+    }
+
+    if (!jsonPath.empty() && !writeJsonResults(jsonPath, rows)) {
+        cerr << "Could not write " << jsonPath << "\n";
+        return 1;
+    }
+    return 0;
+}